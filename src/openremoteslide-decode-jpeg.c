@@ -242,6 +242,7 @@ void _openremoteslide_jpeg_propagate_error(GError **err,
 }
 
 void _openremoteslide_jpeg_decompress_destroy(struct _openremoteslide_jpeg_decompress *dc) {
+  _openremoteslide_jpeg_src_release(&dc->cinfo);
   jpeg_destroy_decompress(&dc->cinfo);
   g_assert(dc->jerr.err == NULL);
   if (dc->allocated_row_size) {
@@ -252,7 +253,7 @@ void _openremoteslide_jpeg_decompress_destroy(struct _openremoteslide_jpeg_decom
   g_slice_free(struct _openremoteslide_jpeg_decompress, dc);
 }
 
-static bool jpeg_get_dimensions(URLIO_FILE *f,  // or:
+static bool jpeg_get_dimensions(URLIO_FILE *f, int64_t offset,  // or:
                                 const void *buf, uint32_t buflen,
                                 int32_t *w, int32_t *h,
                                 GError **err) {
@@ -267,7 +268,7 @@ static bool jpeg_get_dimensions(URLIO_FILE *f,  // or:
     _openremoteslide_jpeg_decompress_init(dc, &env);
 
     if (f) {
-      _openremoteslide_jpeg_stdio_src(cinfo, f);
+      _openremoteslide_jpeg_stdio_src(cinfo, f, offset);
     } else {
       _openremoteslide_jpeg_mem_src(cinfo, (void *) buf, buflen);
     }
@@ -303,13 +304,8 @@ bool _openremoteslide_jpeg_read_dimensions(const char *filename,
   if (f == NULL) {
     return false;
   }
-  if (offset && urlio_fseek(f, offset, SEEK_SET) == -1) {
-    _openremoteslide_io_error(err, "Cannot seek to offset");
-    urlio_fclose(f);
-    return false;
-  }
 
-  bool success = jpeg_get_dimensions(f, NULL, 0, w, h, err);
+  bool success = jpeg_get_dimensions(f, offset, NULL, 0, w, h, err);
 
   urlio_fclose(f);
   return success;
@@ -318,10 +314,10 @@ bool _openremoteslide_jpeg_read_dimensions(const char *filename,
 bool _openremoteslide_jpeg_decode_buffer_dimensions(const void *buf, uint32_t len,
                                               int32_t *w, int32_t *h,
                                               GError **err) {
-  return jpeg_get_dimensions(NULL, buf, len, w, h, err);
+  return jpeg_get_dimensions(NULL, 0, buf, len, w, h, err);
 }
 
-static bool jpeg_decode(URLIO_FILE *f,  // or:
+static bool jpeg_decode(URLIO_FILE *f, int64_t offset,  // or:
                         const void *buf, uint32_t buflen,
                         void *dest, bool grayscale,
                         int32_t w, int32_t h,
@@ -338,7 +334,7 @@ static bool jpeg_decode(URLIO_FILE *f,  // or:
 
     // set up I/O
     if (f) {
-      _openremoteslide_jpeg_stdio_src(cinfo, f);
+      _openremoteslide_jpeg_stdio_src(cinfo, f, offset);
     } else {
       _openremoteslide_jpeg_mem_src(cinfo, (void *) buf, buflen);
     }
@@ -377,13 +373,8 @@ bool _openremoteslide_jpeg_read(const char *filename,
   if (f == NULL) {
     return false;
   }
-  if (offset && urlio_fseek(f, offset, SEEK_SET) == -1) {
-    _openremoteslide_io_error(err, "Cannot seek to offset");
-    urlio_fclose(f);
-    return false;
-  }
 
-  bool success = jpeg_decode(f, NULL, 0, dest, false, w, h, err);
+  bool success = jpeg_decode(f, offset, NULL, 0, dest, false, w, h, err);
 
   urlio_fclose(f);
   return success;
@@ -395,7 +386,7 @@ bool _openremoteslide_jpeg_decode_buffer(const void *buf, uint32_t len,
                                    GError **err) {
   //g_debug("decode JPEG buffer: %x %u", buf, len);
 
-  return jpeg_decode(NULL, buf, len, dest, false, w, h, err);
+  return jpeg_decode(NULL, 0, buf, len, dest, false, w, h, err);
 }
 
 bool _openremoteslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
@@ -404,7 +395,7 @@ bool _openremoteslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
                                         GError **err) {
   //g_debug("decode grayscale JPEG buffer: %x %u", buf, len);
 
-  return jpeg_decode(NULL, buf, len, dest, true, w, h, err);
+  return jpeg_decode(NULL, 0, buf, len, dest, true, w, h, err);
 }
 
 static bool get_associated_image_data(struct _openremoteslide_associated_image *_img,
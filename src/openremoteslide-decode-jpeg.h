@@ -68,7 +68,9 @@ bool _openremoteslide_jpeg_add_associated_image(openremoteslide_t *osr,
  * On Windows, we cannot fopen a file and pass it to another DLL that does fread.
  * So we need to compile all our freading into the OpenSlide DLL directly.
  */
-void _openremoteslide_jpeg_stdio_src(j_decompress_ptr cinfo, URLIO_FILE *infile);
+void _openremoteslide_jpeg_stdio_src(j_decompress_ptr cinfo, URLIO_FILE *infile,
+                               int64_t offset);
+void _openremoteslide_jpeg_src_release(j_decompress_ptr cinfo);
 
 /*
  * Some libjpegs don't provide mem_src, so we have our own copy.
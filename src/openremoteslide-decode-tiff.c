@@ -38,11 +38,15 @@
 
 #define HANDLE_CACHE_MAX 32
 
+// rows of tiles are prefetched together until they add up to this much data
+#define PREFETCH_BATCH_BYTES (4 * 1024 * 1024)
+
 struct _openremoteslide_tiffcache {
   char *filename;
   GQueue *cache;
   GMutex *lock;
   int outstanding;
+  URLIO_FILE *file;  // shared by every TIFF handle; reads are positional
 };
 
 // not thread-safe, like libtiff
@@ -58,6 +62,19 @@ struct associated_image {
   tdir_t directory;
 };
 
+// the long-lived I/O handle for tc, opened on first use
+// _openremoteslide_fopen() sets FD_CLOEXEC, so keeping it open is safe
+static URLIO_FILE *tiffcache_file(struct _openremoteslide_tiffcache *tc,
+                                  GError **err) {
+  g_mutex_lock(tc->lock);
+  if (tc->file == NULL) {
+    tc->file = _openremoteslide_fopen(tc->filename, "rb", err);
+  }
+  URLIO_FILE *f = tc->file;
+  g_mutex_unlock(tc->lock);
+  return f;
+}
+
 #define SET_DIR_OR_FAIL(tiff, i)					\
   do {									\
     if (!_openremoteslide_tiff_set_dir(tiff, i, err)) {			\
@@ -292,8 +309,9 @@ bool _openremoteslide_tiff_read_tile(struct _openremoteslide_tiff_level *tiffl,
     // read data
     void *buf;
     int32_t buflen;
+    struct urlio_block *block;
     if (!_openremoteslide_tiff_read_tile_data(tiffl, tiff,
-                                        &buf, &buflen,
+                                        &buf, &buflen, &block,
                                         tile_col, tile_row,
                                         err)) {
       return false;
@@ -305,7 +323,7 @@ bool _openremoteslide_tiff_read_tile(struct _openremoteslide_tiff_level *tiffl,
                            dest,
                            tiffl->tile_w, tiffl->tile_h,
                            err);
-    g_free(buf);
+    _openremoteslide_tiff_free_tile_data(buf, block);
     return ret;
   } else {
     // Fallback: read tile through libtiff
@@ -321,8 +339,11 @@ bool _openremoteslide_tiff_read_tile(struct _openremoteslide_tiff_level *tiffl,
 bool _openremoteslide_tiff_read_tile_data(struct _openremoteslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **_buf, int32_t *_len,
+                                    struct urlio_block **_block,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err) {
+  struct tiff_file_handle *hdl = TIFFClientdata(tiff);
+
   // set directory
   SET_DIR_OR_FAIL(tiff, tiffl->dir);
 
@@ -334,31 +355,145 @@ bool _openremoteslide_tiff_read_tile_data(struct _openremoteslide_tiff_level *ti
 
   //g_debug("_openremoteslide_tiff_read_tile_data reading tile %d", tile_no);
 
-  // get tile size
+  // get tile location
+  toff_t *offsets;
   toff_t *sizes;
-  if (TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes) == 0) {
+  if (TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) == 0 ||
+      TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes) == 0) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Cannot get tile size");
     return false;  // ok, haven't allocated anything yet
   }
   tsize_t tile_size = sizes[tile_no];
 
-  // get raw tile
-  tdata_t buf = g_malloc(tile_size);
-  tsize_t size = TIFFReadRawTile(tiff, tile_no, buf, tile_size);
-  if (size == -1) {
+  URLIO_FILE *f = tiffcache_file(hdl->tc, err);
+  if (f == NULL) {
+    return false;
+  }
+
+  // borrow the tile from the I/O cache; a miss fetches exactly its bytes
+  const char *data;
+  struct urlio_block *block;
+  size_t count = urlio_pview_range(f, offsets[tile_no], tile_size,
+                                   &data, &block);
+  if (count != (size_t) tile_size) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Cannot read raw tile");
-    g_free(buf);
+    if (block) {
+      urlio_block_unref(block);
+    }
     return false;
   }
 
   // set outputs
-  *_buf = buf;
-  *_len = size;
+  *_buf = (void *) data;
+  *_len = tile_size;
+  *_block = block;
   return true;
 }
 
+// release the result of _openremoteslide_tiff_read_tile_data()
+void _openremoteslide_tiff_free_tile_data(void *buf, struct urlio_block *block) {
+  if (block) {
+    urlio_block_unref(block);
+  } else {
+    g_free(buf);
+  }
+}
+
+// warm the I/O cache with the raw data of a rectangle of tiles, without
+// decoding anything.  tile_col/tile_row bounds are inclusive-exclusive.
+bool _openremoteslide_tiff_prefetch_tiles(struct _openremoteslide_tiffcache *tc,
+                                    struct _openremoteslide_tiff_level *tiffl,
+                                    TIFF *tiff,
+                                    struct _openremoteslide_cache *cache,
+                                    struct _openremoteslide_level *level,
+                                    int64_t start_col, int64_t start_row,
+                                    int64_t end_col, int64_t end_row,
+                                    volatile gint *cancelled,
+                                    GError **err) {
+  // set directory
+  SET_DIR_OR_FAIL(tiff, tiffl->dir);
+
+  // get tile locations
+  toff_t *offsets;
+  toff_t *sizes;
+  if (!TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) ||
+      !TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes)) {
+    g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
+                "Cannot get tile locations");
+    return false;
+  }
+
+  URLIO_FILE *f = tiffcache_file(tc, err);
+  if (f == NULL) {
+    return false;
+  }
+
+  bool success = true;
+  start_col = MAX(start_col, 0);
+  start_row = MAX(start_row, 0);
+  end_col = MIN(end_col, tiffl->tiles_across);
+  end_row = MIN(end_row, tiffl->tiles_down);
+  if (end_col <= start_col || end_row <= start_row) {
+    return true;
+  }
+
+  // collect the rectangle a few rows at a time, so the I/O layer can fetch
+  // each batch in as few requests as possible while a cancel still takes
+  // effect between batches; tiles already decoded into the cache are
+  // skipped, and missing tiles have a size of 0
+  GArray *tile_offsets = g_array_new(FALSE, FALSE, sizeof(int64_t));
+  GArray *tile_sizes = g_array_new(FALSE, FALSE, sizeof(int64_t));
+  int64_t batch_bytes = 0;
+  for (int64_t row = start_row; row < end_row; row++) {
+    if (cancelled && g_atomic_int_get(cancelled)) {
+      goto OUT;
+    }
+
+    for (int64_t col = start_col; col < end_col; col++) {
+      if (cache) {
+        struct _openremoteslide_cache_entry *entry;
+        if (_openremoteslide_cache_get(cache, level, col, row, &entry)) {
+          _openremoteslide_cache_entry_unref(entry);
+          continue;
+        }
+      }
+
+      ttile_t tile_no = TIFFComputeTile(tiff,
+                                        col * tiffl->tile_w,
+                                        row * tiffl->tile_h,
+                                        0, 0);
+      int64_t offset = offsets[tile_no];
+      int64_t size = sizes[tile_no];
+      g_array_append_val(tile_offsets, offset);
+      g_array_append_val(tile_sizes, size);
+      batch_bytes += size;
+    }
+
+    if (batch_bytes < PREFETCH_BATCH_BYTES && row + 1 < end_row) {
+      continue;
+    }
+    if (tile_offsets->len &&
+        urlio_fprefetch_ranges(f, tile_offsets->len,
+                               (int64_t *) tile_offsets->data,
+                               (int64_t *) tile_sizes->data)) {
+      _openremoteslide_io_error(err, "Couldn't prefetch tile data from %s",
+                          tc->filename);
+      success = false;
+      goto OUT;
+    }
+    g_array_set_size(tile_offsets, 0);
+    g_array_set_size(tile_sizes, 0);
+    batch_bytes = 0;
+  }
+
+OUT:
+  g_array_free(tile_offsets, TRUE);
+  g_array_free(tile_sizes, TRUE);
+  return success;
+}
+
 // sets out-argument to indicate whether the tile data is zero bytes long
 // returns false on error
 bool _openremoteslide_tiff_check_missing_tile(struct _openremoteslide_tiff_level *tiffl,
@@ -499,19 +634,14 @@ bool _openremoteslide_tiff_add_associated_image(openremoteslide_t *osr,
 static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   struct tiff_file_handle *hdl = th;
 
-  // don't leave the file handle open between calls
-  // also ensures FD_CLOEXEC is set
-  URLIO_FILE *f = _openremoteslide_fopen(hdl->tc->filename, "rb", NULL);
+  URLIO_FILE *f = tiffcache_file(hdl->tc, NULL);
   if (f == NULL) {
     return 0;
   }
-  if (urlio_fseek(f, hdl->offset, SEEK_SET)) {
-    urlio_fclose(f);
-    return 0;
-  }
-  int64_t rsize = urlio_fread(buf, 1, size, f);
+  // directory reads are usually served from the ranges the tifflike
+  // parser fetched during detection
+  int64_t rsize = urlio_pread(f, buf, size, hdl->offset);
   hdl->offset += rsize;
-  urlio_fclose(f);
   return rsize;
 }
 
@@ -557,34 +687,26 @@ static toff_t tiff_do_size(thandle_t th) {
 #undef TIFFClientOpen
 static TIFF *tiff_open(struct _openremoteslide_tiffcache *tc, GError **err) {
   // open
-  URLIO_FILE *f = _openremoteslide_fopen(tc->filename, "rb", err);
+  URLIO_FILE *f = tiffcache_file(tc, err);
   if (f == NULL) {
     return NULL;
   }
 
   // read magic
   uint8_t buf[4];
-  if (urlio_fread(buf, 4, 1, f) != 1) {
+  if (urlio_pread(f, buf, 4, 0) != 4) {
     // can't read
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Couldn't read TIFF magic number for %s", tc->filename);
-    urlio_fclose(f);
     return NULL;
   }
 
   // get size
-  if (urlio_fseek(f, 0, SEEK_END) == -1) {
-    _openremoteslide_io_error(err, "Couldn't seek to end of %s", tc->filename);
-    urlio_fclose(f);
-    return NULL;
-  }
-  int64_t size = urlio_ftell(f);
+  int64_t size = urlio_fsize(f);
   if (size == -1) {
-    _openremoteslide_io_error(err, "Couldn't urlio_ftell() for %s", tc->filename);
-    urlio_fclose(f);
+    _openremoteslide_io_error(err, "Couldn't get size of %s", tc->filename);
     return NULL;
   }
-  urlio_fclose(f);
 
   // check magic
   // TODO: remove if libtiff gets private error/warning callbacks
@@ -687,6 +809,11 @@ void _openremoteslide_tiffcache_put(struct _openremoteslide_tiffcache *tc, TIFF
   }
 }
 
+bool _openremoteslide_tiffcache_is_remote(struct _openremoteslide_tiffcache *tc) {
+  URLIO_FILE *f = tiffcache_file(tc, NULL);
+  return f && urlio_fremote(f);
+}
+
 void _openremoteslide_tiffcache_destroy(struct _openremoteslide_tiffcache *tc) {
   if (tc == NULL) {
     return;
@@ -698,6 +825,9 @@ void _openremoteslide_tiffcache_destroy(struct _openremoteslide_tiffcache *tc) {
   }
   g_assert(tc->outstanding == 0);
   g_mutex_unlock(tc->lock);
+  if (tc->file) {
+    urlio_fclose(tc->file);
+  }
   g_queue_free(tc->cache);
   g_mutex_free(tc->lock);
   g_free(tc->filename);
@@ -63,12 +63,30 @@ bool _openremoteslide_tiff_read_tile(struct _openremoteslide_tiff_level *tiffl,
                                int64_t tile_col, int64_t tile_row,
                                GError **err);
 
+// *buf is borrowed from *block in the I/O cache; on a miss only the tile's
+// own bytes are fetched.  Release with _openremoteslide_tiff_free_tile_data().
 bool _openremoteslide_tiff_read_tile_data(struct _openremoteslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **buf, int32_t *len,
+                                    struct urlio_block **block,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err);
 
+void _openremoteslide_tiff_free_tile_data(void *buf, struct urlio_block *block);
+
+// Pull the raw data of a rectangle of tiles into the I/O cache in a few
+// large batches, checking *cancelled between them.  If cache is given,
+// tiles it already holds for level are skipped.
+bool _openremoteslide_tiff_prefetch_tiles(struct _openremoteslide_tiffcache *tc,
+                                    struct _openremoteslide_tiff_level *tiffl,
+                                    TIFF *tiff,
+                                    struct _openremoteslide_cache *cache,
+                                    struct _openremoteslide_level *level,
+                                    int64_t start_col, int64_t start_row,
+                                    int64_t end_col, int64_t end_row,
+                                    volatile gint *cancelled,
+                                    GError **err);
+
 bool _openremoteslide_tiff_clip_tile(struct _openremoteslide_tiff_level *tiffl,
                                uint32_t *tiledata,
                                int64_t tile_col, int64_t tile_row,
@@ -93,6 +111,9 @@ TIFF *_openremoteslide_tiffcache_get(struct _openremoteslide_tiffcache *tc, GErr
 
 void _openremoteslide_tiffcache_put(struct _openremoteslide_tiffcache *tc, TIFF *tiff);
 
+// whether the slide is read over the network, where prefetching pays off
+bool _openremoteslide_tiffcache_is_remote(struct _openremoteslide_tiffcache *tc);
+
 void _openremoteslide_tiffcache_destroy(struct _openremoteslide_tiffcache *tc);
 
 #endif
@@ -45,6 +45,23 @@
 
 #define NDPI_TAG 65420
 
+// Bytes read speculatively while parsing: the head of the file, which
+// holds the header and often every directory; the tail, where writers
+// that append directories leave them; and a window at each directory
+// found outside both, which usually covers its values too.
+#define SPECULATIVE_HEAD_SIZE (1024 * 1024)
+#define SPECULATIVE_TAIL_SIZE (256 * 1024)
+#define SPECULATIVE_DIR_SIZE (256 * 1024)
+
+// index format, see index_build()
+#define INDEX_MAGIC "ORSIDX01"
+#define INDEX_BIG_ENDIAN 1
+#define INDEX_NDPI 2
+#define INDEX_UINTS 1
+#define INDEX_SINTS 2
+#define INDEX_FLOATS 4
+#define INDEX_BUFFER 8
+
 
 struct _openremoteslide_tifflike {
   char *filename;
@@ -52,6 +69,7 @@ struct _openremoteslide_tifflike {
   bool ndpi;
   GPtrArray *directories;
   GMutex *value_lock;
+  URLIO_FILE *f;  // for reading values
 };
 
 struct tiff_directory {
@@ -59,6 +77,23 @@ struct tiff_directory {
   uint64_t offset;  // only for NDPI fixups
 };
 
+// a borrowed piece of the file
+struct tiff_span {
+  int64_t offset;
+  size_t len;
+  const char *data;
+  struct urlio_block *block;
+};
+
+// the pieces of the file read while parsing directories
+struct tiff_reader {
+  URLIO_FILE *f;
+  int64_t size;  // -1 if unknown
+  bool big_endian;
+  GArray *spans;
+  bool speculated;  // the tail has been asked for
+};
+
 struct tiff_item {
   uint16_t type;
   int64_t count;
@@ -105,15 +140,10 @@ static void fix_byte_order(void *data, int32_t size, int64_t count,
   }
 }
 
-// only sets *ok on failure
-static uint64_t read_uint(URLIO_FILE *f, int32_t size, bool big_endian, bool *ok) {
-  g_assert(ok != NULL);
-
+static uint64_t parse_uint(const uint8_t *data, int32_t size,
+                           bool big_endian) {
   uint8_t buf[size];
-  if (urlio_fread(buf, size, 1, f) != 1) {
-    *ok = false;
-    return 0;
-  }
+  memcpy(buf, data, size);
   fix_byte_order(buf, sizeof(buf), 1, big_endian);
   switch (size) {
   case 1: {
@@ -332,6 +362,7 @@ static bool populate_item(struct _openremoteslide_tifflike *tl,
                           struct tiff_item *item,
                           GError **err) {
   void *buf = NULL;
+  struct urlio_block *block = NULL;
   bool success = false;
 
   g_mutex_lock(tl->value_lock);
@@ -340,11 +371,6 @@ static bool populate_item(struct _openremoteslide_tifflike *tl,
     return true;
   }
 
-  URLIO_FILE *f = _openremoteslide_fopen(tl->filename, "rb", err);
-  if (!f) {
-    goto FAIL;
-  }
-
   uint64_t count = item->count;
   int32_t value_size = get_value_size(item->type, &count);
   g_assert(value_size);
@@ -358,15 +384,15 @@ static bool populate_item(struct _openremoteslide_tifflike *tl,
   }
 
   //g_debug("reading tiff value: len: %"PRId64", offset %"PRIu64, len, item->offset);
-  if (urlio_fseek(f, item->offset, SEEK_SET)) {
-    _openremoteslide_io_error(err, "Couldn't seek to read TIFF value");
-    goto FAIL;
-  }
-  if (urlio_fread(buf, len, 1, f) != 1) {
+  // exactly the value's bytes, unless a prefetch already brought them in
+  const char *data;
+  if (urlio_pview_range(tl->f, item->offset, len, &data, &block) !=
+      (size_t) len) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Couldn't read TIFF value");
     goto FAIL;
   }
+  memcpy(buf, data, len);
 
   fix_byte_order(buf, value_size, count, tl->big_endian);
   if (!set_item_values(item, buf, err)) {
@@ -378,8 +404,8 @@ static bool populate_item(struct _openremoteslide_tifflike *tl,
 FAIL:
   g_mutex_unlock(tl->value_lock);
   g_free(buf);
-  if (f) {
-    urlio_fclose(f);
+  if (block) {
+    urlio_block_unref(block);
   }
   return success;
 }
@@ -402,7 +428,113 @@ static void tiff_item_destroy(gpointer data) {
   g_slice_free(struct tiff_item, item);
 }
 
-static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
+static void reader_init(struct tiff_reader *r, URLIO_FILE *f) {
+  r->f = f;
+  // a remote server may not have told us
+  r->size = urlio_fsize(f);
+  if (r->size <= 0) {
+    r->size = -1;
+  }
+  r->spans = g_array_new(false, false, sizeof(struct tiff_span));
+  r->speculated = false;
+}
+
+static void reader_destroy(struct tiff_reader *r) {
+  if (r->spans == NULL) {
+    return;
+  }
+  for (guint i = 0; i < r->spans->len; i++) {
+    urlio_block_unref(g_array_index(r->spans, struct tiff_span, i).block);
+  }
+  g_array_free(r->spans, true);
+  r->spans = NULL;
+}
+
+// how much of [offset, offset + len) lies within the file
+static uint64_t reader_clip(struct tiff_reader *r, int64_t offset,
+                            uint64_t len) {
+  if (r->size < 0) {
+    return len;
+  }
+  if (offset >= r->size) {
+    return 0;
+  }
+  return MIN(len, (uint64_t) (r->size - offset));
+}
+
+// [offset, offset + len) if it has already been read, else NULL
+static const uint8_t *reader_find(struct tiff_reader *r, int64_t offset,
+                                  uint64_t len) {
+  for (guint i = 0; i < r->spans->len; i++) {
+    struct tiff_span *span = &g_array_index(r->spans, struct tiff_span, i);
+    if (offset >= span->offset &&
+        (uint64_t) (offset - span->offset) <= span->len &&
+        len <= span->len - (offset - span->offset)) {
+      return (const uint8_t *) span->data + (offset - span->offset);
+    }
+  }
+  return NULL;
+}
+
+static bool reader_add(struct tiff_reader *r, int64_t offset, uint64_t len) {
+  struct tiff_span span = { .offset = offset };
+  len = reader_clip(r, offset, len);
+  if (offset < 0 || len == 0 || len > SSIZE_MAX) {
+    return false;
+  }
+  span.len = urlio_pview_range(r->f, offset, len, &span.data, &span.block);
+  if (span.len == 0) {
+    return false;
+  }
+  g_array_append_val(r->spans, span);
+  return true;
+}
+
+// Read a window at offset together with the tail of the file, in one
+// round trip.  Failures are left for the caller to retry.
+static void reader_speculate(struct tiff_reader *r, int64_t offset,
+                             uint64_t len) {
+  int64_t offsets[2];
+  int64_t lengths[2];
+  int count = 0;
+  int64_t tail = MAX(r->size - SPECULATIVE_TAIL_SIZE, SPECULATIVE_HEAD_SIZE);
+  if (offset < tail) {
+    offsets[count] = offset;
+    lengths[count++] = reader_clip(r, offset, len);
+  }
+  if (tail < r->size) {
+    offsets[count] = tail;
+    lengths[count++] = r->size - tail;
+  }
+
+  // fetch both, then borrow them from the cache
+  urlio_fprefetch_ranges(r->f, count, offsets, lengths);
+  for (int i = 0; i < count; i++) {
+    reader_add(r, offsets[i], lengths[i]);
+  }
+}
+
+// Borrow [offset, offset + len), reading a speculative window if needed.
+// The first time the head falls short, the tail comes along too.
+static const uint8_t *reader_get(struct tiff_reader *r, int64_t offset,
+                                 uint64_t len) {
+  if (offset < 0 || reader_clip(r, offset, len) < len) {
+    return NULL;
+  }
+  const uint8_t *data = reader_find(r, offset, len);
+  if (!data && !r->speculated && r->size >= 0) {
+    r->speculated = true;
+    reader_speculate(r, offset, MAX(len, SPECULATIVE_DIR_SIZE));
+    data = reader_find(r, offset, len);
+  }
+  if (!data && reader_add(r, offset, MAX(len, SPECULATIVE_DIR_SIZE))) {
+    data = reader_find(r, offset, len);
+  }
+  return data;
+}
+
+static struct tiff_directory *read_directory(struct tiff_reader *r,
+                                             int64_t *diroff,
                                              struct tiff_directory *first_dir,
                                              GHashTable *loop_detector,
                                              bool bigtiff,
@@ -412,7 +544,6 @@ static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
   int64_t off = *diroff;
   *diroff = 0;
   struct tiff_directory *d = NULL;
-  bool ok = true;
 
   //  g_debug("diroff: %"PRId64, off);
 
@@ -433,22 +564,35 @@ static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
   *key = off;
   g_hash_table_insert(loop_detector, key, NULL);
 
-  // no loop, let's seek
-  if (urlio_fseek(f, off, SEEK_SET) != 0) {
-    _openremoteslide_io_error(err, "Cannot seek to offset");
-    goto FAIL;
-  }
-
   // read directory count
-  uint64_t dircount = read_uint(f, bigtiff ? 8 : 2, big_endian, &ok);
-  if (!ok) {
+  int32_t count_size = bigtiff ? 8 : 2;
+  const uint8_t *p = reader_get(r, off, count_size);
+  if (!p) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Cannot read dircount");
     goto FAIL;
   }
+  uint64_t dircount = parse_uint(p, count_size, big_endian);
 
   //  g_debug("dircount: %"PRIu64, dircount);
 
+  // the entries and next dir offset follow in one piece
+  int32_t value_field_size = bigtiff ? 8 : 4;
+  int32_t entry_size = 2 + 2 + 2 * value_field_size;
+  int32_t next_size = (bigtiff || ndpi) ? 8 : 4;
+  if (dircount > (SSIZE_MAX - count_size - next_size) / entry_size) {
+    g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
+                "Directory count too large");
+    goto FAIL;
+  }
+  p = reader_get(r, off, count_size + dircount * entry_size + next_size);
+  if (!p) {
+    g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
+                "Cannot read directory entries");
+    goto FAIL;
+  }
+  p += count_size;
+
 
   // initial checks passed, initialize the directory
   d = g_slice_new0(struct tiff_directory);
@@ -458,15 +602,10 @@ static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
 
   // read all directory entries
   for (uint64_t n = 0; n < dircount; n++) {
-    uint16_t tag = read_uint(f, 2, big_endian, &ok);
-    uint16_t type = read_uint(f, 2, big_endian, &ok);
-    uint64_t count = read_uint(f, bigtiff ? 8 : 4, big_endian, &ok);
-
-    if (!ok) {
-      g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
-                  "Cannot read tag, type, and count");
-      goto FAIL;
-    }
+    uint16_t tag = parse_uint(p, 2, big_endian);
+    uint16_t type = parse_uint(p + 2, 2, big_endian);
+    uint64_t count = parse_uint(p + 4, value_field_size, big_endian);
+    p += 4 + value_field_size;
 
     //    g_debug(" tag: %d, type: %d, count: %"PRId64, tag, type, count);
 
@@ -491,13 +630,10 @@ static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
       goto FAIL;
     }
 
-    // read in the value/offset
-    uint8_t value[bigtiff ? 8 : 4];
-    if (urlio_fread(value, sizeof(value), 1, f) != 1) {
-      g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
-                  "Cannot read value/offset");
-      goto FAIL;
-    }
+    // copy out the value/offset
+    uint8_t value[value_field_size];
+    memcpy(value, p, sizeof(value));
+    p += sizeof(value);
 
     // does value/offset contain the value?
     if (value_size * count <= sizeof(value)) {
@@ -535,14 +671,7 @@ static struct tiff_directory *read_directory(URLIO_FILE *f, int64_t *diroff,
   }
 
   // read the next dir offset
-  int64_t nextdiroff = read_uint(f, (bigtiff || ndpi) ? 8 : 4,
-                                 big_endian, &ok);
-  if (!ok) {
-    g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
-                "Cannot read next directory offset");
-    goto FAIL;
-  }
-  *diroff = nextdiroff;
+  *diroff = parse_uint(p, next_size, big_endian);
 
   // success
   return d;
@@ -553,10 +682,189 @@ FAIL:
   return NULL;
 }
 
+// set an out-of-line value from the pieces read while parsing, if they
+// cover it; otherwise it is read on first use
+static void populate_item_from_reader(gpointer key G_GNUC_UNUSED,
+                                      gpointer value,
+                                      gpointer user_data) {
+  struct tiff_item *item = value;
+  struct tiff_reader *r = user_data;
+
+  if (item->offset == NO_OFFSET) {
+    return;
+  }
+  uint64_t count = item->count;
+  int32_t value_size = get_value_size(item->type, &count);
+  const uint8_t *data = reader_find(r, item->offset, value_size * count);
+  if (!data) {
+    return;
+  }
+  void *buf = g_try_malloc(value_size * count);
+  if (buf) {
+    memcpy(buf, data, value_size * count);
+    fix_byte_order(buf, value_size, count, r->big_endian);
+    set_item_values(item, buf, NULL);
+    g_free(buf);
+  }
+}
+
+static void index_put(GByteArray *b, uint64_t value) {
+  value = GUINT64_TO_LE(value);
+  g_byte_array_append(b, (const guint8 *) &value, sizeof(value));
+}
+
+// only sets *ok on failure
+static uint64_t index_get(const uint8_t **p, const uint8_t *end, bool *ok) {
+  uint64_t value;
+  if (end - *p < (ptrdiff_t) sizeof(value)) {
+    *ok = false;
+    return 0;
+  }
+  memcpy(&value, *p, sizeof(value));
+  *p += sizeof(value);
+  return GUINT64_FROM_LE(value);
+}
+
+// Serialize every directory and value, or return NULL if some value
+// couldn't be read.  The index is a sequence of little-endian uint64s
+// after INDEX_MAGIC:
+//   flags, directory count, then per directory:
+//     offset, item count, then per item:
+//       tag, type, count, which of uints/sints/floats/buffer are set,
+//       then those arrays: count elements each, doubles as their bits,
+//       and for the buffer count + 1 raw bytes padded to 8
+static GByteArray *index_build(struct _openremoteslide_tifflike *tl) {
+  GByteArray *b = g_byte_array_new();
+  g_byte_array_append(b, (const guint8 *) INDEX_MAGIC, strlen(INDEX_MAGIC));
+  index_put(b, (tl->big_endian ? INDEX_BIG_ENDIAN : 0) |
+               (tl->ndpi ? INDEX_NDPI : 0));
+  index_put(b, tl->directories->len);
+
+  for (guint n = 0; n < tl->directories->len; n++) {
+    struct tiff_directory *d = tl->directories->pdata[n];
+    index_put(b, d->offset);
+    index_put(b, g_hash_table_size(d->items));
+
+    GHashTableIter iter;
+    gpointer tag;
+    struct tiff_item *item;
+    g_hash_table_iter_init(&iter, d->items);
+    while (g_hash_table_iter_next(&iter, &tag, (gpointer *) &item)) {
+      if (item->offset != NO_OFFSET) {
+        g_byte_array_free(b, true);
+        return NULL;
+      }
+      index_put(b, GPOINTER_TO_INT(tag));
+      index_put(b, item->type);
+      index_put(b, item->count);
+      index_put(b, (item->uints ? INDEX_UINTS : 0) |
+                   (item->sints ? INDEX_SINTS : 0) |
+                   (item->floats ? INDEX_FLOATS : 0) |
+                   (item->buffer ? INDEX_BUFFER : 0));
+      for (int64_t i = 0; item->uints && i < item->count; i++) {
+        index_put(b, item->uints[i]);
+      }
+      for (int64_t i = 0; item->sints && i < item->count; i++) {
+        index_put(b, item->sints[i]);
+      }
+      for (int64_t i = 0; item->floats && i < item->count; i++) {
+        uint64_t bits;
+        memcpy(&bits, &item->floats[i], sizeof(bits));
+        index_put(b, bits);
+      }
+      if (item->buffer) {
+        static const guint8 padding[8];
+        g_byte_array_append(b, item->buffer, item->count + 1);
+        g_byte_array_append(b, padding, (8 - (item->count + 1) % 8) % 8);
+      }
+    }
+  }
+  return b;
+}
+
+// rebuild the directories from an index, or return false if it's invalid
+static bool index_load(struct _openremoteslide_tifflike *tl,
+                       const char *data, size_t len) {
+  const uint8_t *p = (const uint8_t *) data;
+  const uint8_t *end = p + len;
+  bool ok = true;
+
+  if (len < strlen(INDEX_MAGIC) ||
+      memcmp(p, INDEX_MAGIC, strlen(INDEX_MAGIC))) {
+    return false;
+  }
+  p += strlen(INDEX_MAGIC);
+
+  uint64_t flags = index_get(&p, end, &ok);
+  tl->big_endian = flags & INDEX_BIG_ENDIAN;
+  tl->ndpi = flags & INDEX_NDPI;
+  uint64_t dircount = index_get(&p, end, &ok);
+
+  for (uint64_t n = 0; ok && n < dircount; n++) {
+    struct tiff_directory *d = g_slice_new0(struct tiff_directory);
+    d->items = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                     NULL, tiff_item_destroy);
+    g_ptr_array_add(tl->directories, d);
+    d->offset = index_get(&p, end, &ok);
+    uint64_t itemcount = index_get(&p, end, &ok);
+
+    for (uint64_t i = 0; ok && i < itemcount; i++) {
+      uint16_t tag = index_get(&p, end, &ok);
+      struct tiff_item *item = g_slice_new0(struct tiff_item);
+      g_hash_table_insert(d->items, GINT_TO_POINTER(tag), item);
+      item->type = index_get(&p, end, &ok);
+      item->count = index_get(&p, end, &ok);
+      item->offset = NO_OFFSET;
+      uint64_t arrays = index_get(&p, end, &ok);
+
+      // check counts before allocating for them
+      if (!ok || item->count < 0 ||
+          (uint64_t) item->count >= (uint64_t) (end - p)) {
+        return false;
+      }
+      if ((arrays & (INDEX_UINTS | INDEX_SINTS | INDEX_FLOATS)) &&
+          (uint64_t) item->count > (uint64_t) (end - p) / 8) {
+        return false;
+      }
+      if (arrays & INDEX_UINTS) {
+        item->uints = g_new(uint64_t, item->count);
+        for (int64_t j = 0; j < item->count; j++) {
+          item->uints[j] = index_get(&p, end, &ok);
+        }
+      }
+      if (arrays & INDEX_SINTS) {
+        item->sints = g_new(int64_t, item->count);
+        for (int64_t j = 0; j < item->count; j++) {
+          item->sints[j] = index_get(&p, end, &ok);
+        }
+      }
+      if (arrays & INDEX_FLOATS) {
+        item->floats = g_new(double, item->count);
+        for (int64_t j = 0; j < item->count; j++) {
+          uint64_t bits = index_get(&p, end, &ok);
+          memcpy(&item->floats[j], &bits, sizeof(bits));
+        }
+      }
+      if (arrays & INDEX_BUFFER) {
+        uint64_t buffer_len = item->count + 1;
+        uint64_t padded_len = (buffer_len + 7) / 8 * 8;
+        if ((uint64_t) (end - p) < padded_len) {
+          return false;
+        }
+        item->buffer = g_malloc(buffer_len);
+        memcpy(item->buffer, p, buffer_len);
+        p += padded_len;
+      }
+    }
+  }
+  return ok && p == end && tl->directories->len;
+}
+
 struct _openremoteslide_tifflike *_openremoteslide_tifflike_create(const char *filename,
                                                        GError **err) {
   struct _openremoteslide_tifflike *tl = NULL;
   GHashTable *loop_detector = NULL;
+  struct tiff_reader r = { .spans = NULL };
 
   // open file
   URLIO_FILE *f = _openremoteslide_fopen(filename, "rb", err);
@@ -564,40 +872,68 @@ struct _openremoteslide_tifflike *_openremoteslide_tifflike_create(const char *f
     goto FAIL;
   }
 
-  // read and check magic
-  uint16_t magic;
-  if (urlio_fread(&magic, sizeof magic, 1, f) != 1) {
+  // use the index of a previous parse if there is one
+  const char *index;
+  struct urlio_block *index_block;
+  size_t index_len = urlio_fget_index(f, &index, &index_block);
+  if (index_len) {
+    tl = g_slice_new0(struct _openremoteslide_tifflike);
+    tl->filename = g_strdup(filename);
+    tl->directories = g_ptr_array_new();
+    tl->value_lock = g_mutex_new();
+    bool loaded = index_load(tl, index, index_len);
+    urlio_block_unref(index_block);
+    if (loaded) {
+      tl->f = f;
+      return tl;
+    }
+    // parse it again
+    _openremoteslide_tifflike_destroy(tl);
+    tl = NULL;
+  }
+
+  // read the head of the file, and check magic
+  reader_init(&r, f);
+  reader_add(&r, 0, SPECULATIVE_HEAD_SIZE);
+  const uint8_t *p = reader_find(&r, 0, 2);
+  if (!p) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Can't read TIFF magic number");
     goto FAIL;
   }
+  uint16_t magic;
+  memcpy(&magic, p, sizeof magic);
   if (magic != TIFF_BIGENDIAN && magic != TIFF_LITTLEENDIAN) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Unrecognized TIFF magic number");
     goto FAIL;
   }
   bool big_endian = (magic == TIFF_BIGENDIAN);
+  r.big_endian = big_endian;
 
   //  g_debug("magic: %d", magic);
 
   // read rest of header
-  bool ok = true;
-  uint16_t version = read_uint(f, 2, big_endian, &ok);
+  p = reader_find(&r, 2, 2);
+  uint16_t version = p ? parse_uint(p, 2, big_endian) : 0;
   bool bigtiff = (version == TIFF_VERSION_BIG);
   uint16_t offset_size = 0;
   uint16_t pad = 0;
-  if (bigtiff) {
-    offset_size = read_uint(f, 2, big_endian, &ok);
-    pad = read_uint(f, 2, big_endian, &ok);
+  int32_t header_size = bigtiff ? 16 : 12;
+  if (p) {
+    p = reader_find(&r, 0, header_size);
   }
-  // for classic TIFF, will mask off the high bytes after NDPI detection
-  int64_t diroff = read_uint(f, 8, big_endian, &ok);
-
-  if (!ok) {
+  if (!p) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Can't read TIFF header");
     goto FAIL;
   }
+  if (bigtiff) {
+    offset_size = parse_uint(p + 4, 2, big_endian);
+    pad = parse_uint(p + 6, 2, big_endian);
+  }
+  // for classic TIFF, will mask off the high bytes after NDPI detection
+  int64_t diroff = parse_uint(p + header_size - 8, 8, big_endian);
 
   //  g_debug("version: %d", version);
 
@@ -634,7 +970,7 @@ struct _openremoteslide_tifflike *_openremoteslide_tifflike_create(const char *f
   // valid directory containing the NDPI_TAG.
   if (!bigtiff && diroff != 0) {
     int64_t trial_diroff = diroff;
-    struct tiff_directory *d = read_directory(f, &trial_diroff,
+    struct tiff_directory *d = read_directory(&r, &trial_diroff,
                                               NULL,
                                               loop_detector,
                                               bigtiff, true, big_endian,
@@ -668,7 +1004,7 @@ struct _openremoteslide_tifflike *_openremoteslide_tifflike_create(const char *f
   // read all the directories
   while (diroff != 0) {
     // read a directory
-    struct tiff_directory *d = read_directory(f, &diroff,
+    struct tiff_directory *d = read_directory(&r, &diroff,
                                               first_dir,
                                               loop_detector,
                                               bigtiff, tl->ndpi, big_endian,
@@ -693,12 +1029,32 @@ struct _openremoteslide_tifflike *_openremoteslide_tifflike_create(const char *f
     goto FAIL;
   }
 
+  // take the values we already have
+  for (uint32_t n = 0; n < tl->directories->len; n++) {
+    struct tiff_directory *d = tl->directories->pdata[n];
+    g_hash_table_foreach(d->items, populate_item_from_reader, &r);
+  }
+
+  // keep the handle for reading the other values
+  tl->f = f;
+
+  // save an index for the next open, once every value is in
+  if (urlio_findexable(f)) {
+    _openremoteslide_tifflike_prefetch_values(tl, NULL, 0);
+    GByteArray *b = index_build(tl);
+    if (b) {
+      urlio_fput_index(f, b->data, b->len);
+      g_byte_array_free(b, true);
+    }
+  }
+
+  reader_destroy(&r);
   g_hash_table_unref(loop_detector);
-  urlio_fclose(f);
   return tl;
 
 FAIL:
   _openremoteslide_tifflike_destroy(tl);
+  reader_destroy(&r);
   if (loop_detector) {
     g_hash_table_unref(loop_detector);
   }
@@ -719,11 +1075,63 @@ void _openremoteslide_tifflike_destroy(struct _openremoteslide_tifflike *tl) {
   }
   g_mutex_unlock(tl->value_lock);
   g_ptr_array_free(tl->directories, true);
+  if (tl->f) {
+    urlio_fclose(tl->f);
+  }
   g_free(tl->filename);
   g_mutex_free(tl->value_lock);
   g_slice_free(struct _openremoteslide_tifflike, tl);
 }
 
+void _openremoteslide_tifflike_prefetch_values(struct _openremoteslide_tifflike *tl,
+                                         const int64_t *dirs, int64_t count) {
+  GPtrArray *items = g_ptr_array_new();
+  GArray *offsets = g_array_new(false, false, sizeof(int64_t));
+  GArray *lengths = g_array_new(false, false, sizeof(int64_t));
+
+  // collect the values not yet read
+  g_mutex_lock(tl->value_lock);
+  if (dirs == NULL) {
+    count = tl->directories->len;
+  }
+  for (int64_t i = 0; i < count; i++) {
+    int64_t dir = dirs ? dirs[i] : i;
+    if (dir < 0 || dir >= tl->directories->len) {
+      continue;
+    }
+    struct tiff_directory *d = tl->directories->pdata[dir];
+    GHashTableIter iter;
+    struct tiff_item *item;
+    g_hash_table_iter_init(&iter, d->items);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &item)) {
+      if (item->offset == NO_OFFSET) {
+        continue;
+      }
+      uint64_t value_count = item->count;
+      int64_t offset = item->offset;
+      int64_t len = get_value_size(item->type, &value_count) * value_count;
+      g_ptr_array_add(items, item);
+      g_array_append_val(offsets, offset);
+      g_array_append_val(lengths, len);
+    }
+  }
+  g_mutex_unlock(tl->value_lock);
+
+  // fetch them together, then take each from the cache; anything that
+  // failed is read again on first use
+  if (items->len) {
+    urlio_fprefetch_ranges(tl->f, items->len, (int64_t *) offsets->data,
+                           (int64_t *) lengths->data);
+    for (guint i = 0; i < items->len; i++) {
+      populate_item(tl, items->pdata[i], NULL);
+    }
+  }
+
+  g_ptr_array_free(items, true);
+  g_array_free(offsets, true);
+  g_array_free(lengths, true);
+}
+
 static struct tiff_item *get_item(struct _openremoteslide_tifflike *tl,
                                   int64_t dir, int32_t tag) {
   if (dir < 0 || dir >= tl->directories->len) {
@@ -1151,14 +1559,9 @@ static bool hash_tiff_level(struct _openremoteslide_hash *hash,
   }
 
   // hash raw data of each tile/strip
-  for (int64_t i = 0; i < count; i++) {
-    if (!_openremoteslide_hash_file_part(hash, tl->filename, offsets[i], lengths[i],
-                                   err)) {
-      return false;
-    }
-  }
-
-  return true;
+  return _openremoteslide_hash_file_parts(hash, tl->filename, count,
+                                          (const int64_t *) offsets,
+                                          (const int64_t *) lengths, err);
 }
 
 bool _openremoteslide_tifflike_init_properties_and_hash(openremoteslide_t *osr,
@@ -1167,6 +1570,10 @@ bool _openremoteslide_tifflike_init_properties_and_hash(openremoteslide_t *osr,
                                                   int32_t lowest_resolution_level,
                                                   int32_t property_dir,
                                                   GError **err) {
+  // read the values of both directories together
+  int64_t dirs[] = {lowest_resolution_level, property_dir};
+  _openremoteslide_tifflike_prefetch_values(tl, dirs, G_N_ELEMENTS(dirs));
+
   // generate hash of the smallest level
   if (!hash_tiff_level(quickhash1, tl, lowest_resolution_level, err)) {
     g_prefix_error(err, "Cannot hash TIFF tiles: ");
@@ -44,6 +44,12 @@ bool _openremoteslide_tifflike_init_properties_and_hash(openremoteslide_t *osr,
                                                   int32_t property_dir,
                                                   GError **err);
 
+// load the out-of-line values of the listed directories, or of every
+// directory if dirs is NULL, with one batch of range requests; values that
+// can't be loaded are read on first use as usual
+void _openremoteslide_tifflike_prefetch_values(struct _openremoteslide_tifflike *tl,
+                                         const int64_t *dirs, int64_t count);
+
 // helpful printout?
 void _openremoteslide_tifflike_print(struct _openremoteslide_tifflike *tl);
 
@@ -32,20 +32,66 @@
 struct _openremoteslide_hash {
   GChecksum *checksum;
   bool enabled;
+
+  // deferred hashes queue their input until the string is wanted
+  bool deferred;
+  GQueue *pending;  // struct hash_part, under lock
+  GMutex *lock;
 };
 
-struct _openremoteslide_hash *_openremoteslide_hash_quickhash1_create(void) {
+// queued input of a deferred hash: a copy of some data, or file ranges
+struct hash_part {
+  void *data;
+  int32_t datalen;
+
+  char *filename;
+  int64_t count;
+  int64_t *offsets;
+  int64_t *lengths;  // -1 for the rest of the file
+};
+
+static struct _openremoteslide_hash *hash_create(bool deferred) {
   struct _openremoteslide_hash *hash = g_slice_new(struct _openremoteslide_hash);
   hash->checksum = g_checksum_new(G_CHECKSUM_SHA256);
   hash->enabled = true;
+  hash->deferred = deferred;
+  hash->pending = g_queue_new();
+  hash->lock = g_mutex_new();
 
   return hash;
 }
 
+struct _openremoteslide_hash *_openremoteslide_hash_quickhash1_create(void) {
+  return hash_create(false);
+}
+
+// Hash nothing until _openremoteslide_hash_get_string() is called, then
+// read all the queued file ranges at once.  Read errors at that point
+// disable the hash instead of failing the open.
+struct _openremoteslide_hash *_openremoteslide_hash_quickhash1_create_deferred(void) {
+  return hash_create(true);
+}
+
+static void hash_part_free(gpointer data) {
+  struct hash_part *part = data;
+  g_free(part->data);
+  g_free(part->filename);
+  g_free(part->offsets);
+  g_free(part->lengths);
+  g_slice_free(struct hash_part, part);
+}
+
 void _openremoteslide_hash_data(struct _openremoteslide_hash *hash, const void *data,
                           int32_t datalen) {
   if (hash && hash->enabled && data && datalen) {
-    g_checksum_update(hash->checksum, data, datalen);
+    if (hash->deferred) {
+      struct hash_part *part = g_slice_new0(struct hash_part);
+      part->data = g_memdup(data, datalen);
+      part->datalen = datalen;
+      g_queue_push_tail(hash->pending, part);
+    } else {
+      g_checksum_update(hash->checksum, data, datalen);
+    }
   }
 }
 
@@ -63,6 +109,15 @@ bool _openremoteslide_hash_file_part(struct _openremoteslide_hash *hash,
 			       const char *filename,
 			       int64_t offset, int64_t size,
 			       GError **err) {
+  return _openremoteslide_hash_file_parts(hash, filename, 1, &offset, &size,
+                                          err);
+}
+
+static bool hash_ranges(struct _openremoteslide_hash *hash,
+                        const char *filename,
+                        int64_t count,
+                        const int64_t *offsets, const int64_t *sizes,
+                        GError **err) {
   bool success = false;
 
   URLIO_FILE *f = _openremoteslide_fopen(filename, "rb", err);
@@ -70,52 +125,117 @@ bool _openremoteslide_hash_file_part(struct _openremoteslide_hash *hash,
     return false;
   }
 
-  if (size == -1) {
-    // hash to end of file
-    if (urlio_fseek(f, 0, SEEK_END)) {
-      _openremoteslide_io_error(err, "Couldn't seek %s", filename);
-      goto DONE;
-    }
-    int64_t len = urlio_ftell(f);
-    if (len == -1) {
-      _openremoteslide_io_error(err, "Couldn't get size of %s", filename);
-      goto DONE;
+  int64_t *lengths = g_memdup(sizes, count * sizeof(*lengths));
+  for (int64_t i = 0; i < count; i++) {
+    if (lengths[i] == -1) {
+      // hash to end of file
+      int64_t len = urlio_fsize(f);
+      if (len == -1) {
+        _openremoteslide_io_error(err, "Couldn't get size of %s", filename);
+        goto DONE;
+      }
+      lengths[i] = len - offsets[i];
     }
-    size = len - offset;
   }
 
-  uint8_t buf[4096];
-
-  if (urlio_fseek(f, offset, SEEK_SET) == -1) {
-    _openremoteslide_io_error(err, "Can't seek in %s", filename);
-    goto DONE;
+  // fetch the tile-sized ranges together, in as few parallel requests as
+  // they allow; a failure shows up again below.  Larger ranges, such as
+  // whole files, are read a block at a time instead.
+  GArray *small_offsets = g_array_new(FALSE, FALSE, sizeof(int64_t));
+  GArray *small_lengths = g_array_new(FALSE, FALSE, sizeof(int64_t));
+  for (int64_t i = 0; i < count; i++) {
+    if (lengths[i] <= CACHE_SIZE) {
+      g_array_append_val(small_offsets, offsets[i]);
+      g_array_append_val(small_lengths, lengths[i]);
+    }
   }
+  if (small_offsets->len) {
+    urlio_fprefetch_ranges(f, small_offsets->len,
+                           (int64_t *) small_offsets->data,
+                           (int64_t *) small_lengths->data);
+  }
+  g_array_free(small_offsets, TRUE);
+  g_array_free(small_lengths, TRUE);
 
-  int64_t bytes_left = size;
-  while (bytes_left > 0) {
-    int64_t bytes_to_read = MIN((int64_t) sizeof buf, bytes_left);
-    int64_t bytes_read = urlio_fread(buf, 1, bytes_to_read, f);
+  // hash straight out of the I/O cache, at most a block per view
+  for (int64_t i = 0; i < count; i++) {
+    int64_t bytes_left = lengths[i];
+    while (bytes_left > 0) {
+      const char *buf;
+      struct urlio_block *block;
+      int64_t bytes_read = urlio_pview_range(f,
+                                             offsets[i] + (lengths[i] - bytes_left),
+                                             MIN(bytes_left, CACHE_SIZE),
+                                             &buf, &block);
 
-    if (bytes_read != bytes_to_read) {
-      g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
-                  "Can't read from %s", filename);
-      goto DONE;
-    }
+      if (bytes_read == 0) {
+        g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
+                    "Can't read from %s", filename);
+        goto DONE;
+      }
 
-    //    g_debug("hash '%s' %"PRId64" %d", filename, offset + (size - bytes_left), bytes_to_read);
+      //    g_debug("hash '%s' %"PRId64" %"PRId64, filename, offsets[i] + (lengths[i] - bytes_left), bytes_read);
 
-    bytes_left -= bytes_read;
+      bytes_left -= bytes_read;
 
-    _openremoteslide_hash_data(hash, buf, bytes_read);
+      _openremoteslide_hash_data(hash, buf, bytes_read);
+      urlio_block_unref(block);
+    }
   }
 
   success = true;
 
 DONE:
+  g_free(lengths);
   urlio_fclose(f);
   return success;
 }
 
+// Hash count ranges of a file, in order.  A size of -1 hashes to the end
+// of the file.
+bool _openremoteslide_hash_file_parts(struct _openremoteslide_hash *hash,
+                                const char *filename,
+                                int64_t count,
+                                const int64_t *offsets, const int64_t *sizes,
+                                GError **err) {
+  if (hash && hash->deferred) {
+    if (hash->enabled && count) {
+      struct hash_part *part = g_slice_new0(struct hash_part);
+      part->filename = g_strdup(filename);
+      part->count = count;
+      part->offsets = g_memdup(offsets, count * sizeof(*offsets));
+      part->lengths = g_memdup(sizes, count * sizeof(*sizes));
+      g_queue_push_tail(hash->pending, part);
+    }
+    return true;
+  }
+  return hash_ranges(hash, filename, count, offsets, sizes, err);
+}
+
+// Feed the queued input of a deferred hash to the checksum.  Call with
+// the lock held.
+static void hash_pending(struct _openremoteslide_hash *hash) {
+  struct hash_part *part;
+  GError *tmp_err = NULL;
+
+  hash->deferred = false;
+  while ((part = g_queue_pop_head(hash->pending)) != NULL) {
+    if (hash->enabled) {
+      if (part->filename) {
+        if (!hash_ranges(hash, part->filename, part->count,
+                         part->offsets, part->lengths, &tmp_err)) {
+          g_warning("Cannot compute quickhash: %s", tmp_err->message);
+          g_clear_error(&tmp_err);
+          hash->enabled = false;
+        }
+      } else {
+        _openremoteslide_hash_data(hash, part->data, part->datalen);
+      }
+    }
+    hash_part_free(part);
+  }
+}
+
 // Invalidate this hash.  Use if this slide is unhashable for some reason.
 void _openremoteslide_hash_disable(struct _openremoteslide_hash *hash) {
   if (hash) {
@@ -123,15 +243,31 @@ void _openremoteslide_hash_disable(struct _openremoteslide_hash *hash) {
   }
 }
 
+// True if the hash is still wanted but has not been computed yet.
+bool _openremoteslide_hash_is_deferred(struct _openremoteslide_hash *hash) {
+  return hash && hash->deferred && hash->enabled;
+}
+
+// Safe to call from several threads; the first caller computes a deferred
+// hash.
 const char *_openremoteslide_hash_get_string(struct _openremoteslide_hash *hash) {
+  const char *result = NULL;
+
+  g_mutex_lock(hash->lock);
+  if (hash->deferred) {
+    hash_pending(hash);
+  }
   if (hash->enabled) {
-    return g_checksum_get_string(hash->checksum);
-  } else {
-    return NULL;
+    result = g_checksum_get_string(hash->checksum);
   }
+  g_mutex_unlock(hash->lock);
+
+  return result;
 }
 
 void _openremoteslide_hash_destroy(struct _openremoteslide_hash *hash) {
+  g_queue_free_full(hash->pending, hash_part_free);
+  g_mutex_free(hash->lock);
   g_checksum_free(hash->checksum);
   g_slice_free(struct _openremoteslide_hash, hash);
 }
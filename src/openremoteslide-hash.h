@@ -35,6 +35,7 @@ struct _openremoteslide_hash;
 
 // constructor
 struct _openremoteslide_hash *_openremoteslide_hash_quickhash1_create(void);
+struct _openremoteslide_hash *_openremoteslide_hash_quickhash1_create_deferred(void);
 
 // hashers
 void _openremoteslide_hash_data(struct _openremoteslide_hash *hash, const void *data,
@@ -46,11 +47,17 @@ bool _openremoteslide_hash_file_part(struct _openremoteslide_hash *hash,
 			       const char *filename,
 			       int64_t offset, int64_t size,
 			       GError **err);
+bool _openremoteslide_hash_file_parts(struct _openremoteslide_hash *hash,
+                                const char *filename,
+                                int64_t count,
+                                const int64_t *offsets, const int64_t *sizes,
+                                GError **err);
 
 // lockout
 void _openremoteslide_hash_disable(struct _openremoteslide_hash *hash);
 
-// accessor
+// accessors
+bool _openremoteslide_hash_is_deferred(struct _openremoteslide_hash *hash);
 const char *_openremoteslide_hash_get_string(struct _openremoteslide_hash *hash);
 
 // destructor
@@ -35,13 +35,16 @@ typedef struct {
   struct jpeg_source_mgr pub;	/* public fields */
 
   URLIO_FILE * infile;		/* source stream */
-  JOCTET * buffer;		/* start of buffer */
+  int64_t offset;		/* next byte to fetch; the stream isn't moved */
+  JOCTET * buffer;		/* start of buffer, for local files and the fake EOI */
+  struct urlio_block * block;	/* cache block the input is borrowed from */
   boolean start_of_file;	/* have we gotten any data yet? */
 } my_source_mgr;
 
 typedef my_source_mgr * my_src_ptr;
 
-#define INPUT_BUF_SIZE  4096	/* choose an efficiently urlio_fread'able size */
+#define INPUT_BUF_SIZE  4096	/* choose an efficiently fread'able size */
+#define INPUT_VIEW_SIZE CACHE_SIZE	/* borrow up to a whole cache block */
 
 
 /*
@@ -102,9 +105,26 @@ static void init_mem_source (j_decompress_ptr cinfo G_GNUC_UNUSED)
 static boolean fill_input_buffer (j_decompress_ptr cinfo)
 {
   my_src_ptr src = (my_src_ptr) cinfo->src;
+  const char *data;
   size_t nbytes;
 
-  nbytes = urlio_fread(src->buffer, 1, INPUT_BUF_SIZE, src->infile);
+  /* the decoder is done with the previous view */
+  if (src->block) {
+    urlio_block_unref(src->block);
+    src->block = NULL;
+  }
+
+  if (src->infile->type == CFTYPE_FILE) {
+    /* local files have no cache to borrow from; read into our buffer */
+    nbytes = urlio_pread(src->infile, src->buffer, INPUT_BUF_SIZE,
+                         src->offset);
+    data = (const char *) src->buffer;
+  } else {
+    /* point the decoder straight at the cached block rather than copying */
+    nbytes = urlio_pview(src->infile, src->offset, INPUT_VIEW_SIZE,
+                         &data, &src->block);
+  }
+  src->offset += nbytes;
 
   if (nbytes <= 0) {
     if (src->start_of_file)	/* Treat empty input file as fatal error */
@@ -113,10 +133,11 @@ static boolean fill_input_buffer (j_decompress_ptr cinfo)
     /* Insert a fake EOI marker */
     src->buffer[0] = (JOCTET) 0xFF;
     src->buffer[1] = (JOCTET) JPEG_EOI;
+    data = (const char *) src->buffer;
     nbytes = 2;
   }
 
-  src->pub.next_input_byte = src->buffer;
+  src->pub.next_input_byte = (const JOCTET *) data;
   src->pub.bytes_in_buffer = nbytes;
   src->start_of_file = false;
 
@@ -205,10 +226,13 @@ static void term_source (j_decompress_ptr cinfo G_GNUC_UNUSED)
 /*
  * Prepare for input from a stdio stream.
  * The caller must have already opened the stream, and is responsible
- * for closing it after finishing decompression.
+ * for closing it after finishing decompression.  Input starts at offset;
+ * reads are positional, so the stream's position is neither used nor
+ * moved, and the stream may be shared with other threads.
  */
 
-void _openremoteslide_jpeg_stdio_src (j_decompress_ptr cinfo, URLIO_FILE * infile)
+void _openremoteslide_jpeg_stdio_src (j_decompress_ptr cinfo, URLIO_FILE * infile,
+                                int64_t offset)
 {
   my_src_ptr src;
 
@@ -227,20 +251,44 @@ void _openremoteslide_jpeg_stdio_src (j_decompress_ptr cinfo, URLIO_FILE * infil
     src->buffer = (JOCTET *)
       (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
 				  INPUT_BUF_SIZE * sizeof(JOCTET));
+    src->block = NULL;
   }
 
   src = (my_src_ptr) cinfo->src;
+  _openremoteslide_jpeg_src_release(cinfo);
   src->pub.init_source = init_source;
   src->pub.fill_input_buffer = fill_input_buffer;
   src->pub.skip_input_data = skip_input_data;
   src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
   src->pub.term_source = term_source;
   src->infile = infile;
+  src->offset = offset;
   src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
   src->pub.next_input_byte = NULL; /* until buffer loaded */
 }
 
 
+/*
+ * Drop the cache block a stdio source is borrowing from, if any.
+ * Must be called before the JPEG object is destroyed, including after
+ * an error exit, since term_source is not called then.
+ */
+
+void _openremoteslide_jpeg_src_release (j_decompress_ptr cinfo)
+{
+  my_src_ptr src = (my_src_ptr) cinfo->src;
+
+  if (src == NULL || src->pub.fill_input_buffer != fill_input_buffer)
+    return;
+  if (src->block) {
+    urlio_block_unref(src->block);
+    src->block = NULL;
+  }
+  src->pub.bytes_in_buffer = 0;
+  src->pub.next_input_byte = NULL;
+}
+
+
 /*
  * Prepare for input from a supplied memory buffer.
  * The buffer must contain the whole JPEG data.
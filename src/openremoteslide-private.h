@@ -75,6 +75,12 @@ struct _openremoteslide {
 
   // file/url name as cache id;
   const char *urlname;
+
+  // outstanding prefetch hints
+  struct _openremoteslide_prefetch *prefetch;
+
+  // quickhash1 still to be computed on first use, or NULL
+  struct _openremoteslide_hash *quickhash1;
 };
 
 struct _openremoteslide_level {
@@ -96,6 +102,14 @@ struct _openremoteslide_ops {
 		       struct _openremoteslide_level *level,
 		       int32_t w, int32_t h,
 		       GError **err);
+  // optional: fetch the compressed data behind a region without decoding
+  // it, checking *cancelled between reads
+  bool (*prefetch_region)(openremoteslide_t *osr,
+			  int64_t x, int64_t y,
+			  struct _openremoteslide_level *level,
+			  int32_t w, int32_t h,
+			  volatile gint *cancelled,
+			  GError **err);
   void (*destroy)(openremoteslide_t *osr);
 };
 
@@ -344,18 +358,11 @@ extern const int32_t _openremoteslide_G_Cb[256];
 extern const int32_t _openremoteslide_G_Cr[256];
 extern const int16_t _openremoteslide_B_Cb[256];
 
-// deprecated prefetch stuff (maybe we'll undeprecate it someday),
-// still needs these declarations for ABI compat
-// TODO: remove if soname bump
-#undef openremoteslide_give_prefetch_hint
-OPENREMOTESLIDE_PUBLIC()
-int openremoteslide_give_prefetch_hint(openremoteslide_t *osr,
-				 int64_t x, int64_t y,
-				 int32_t level,
-				 int64_t w, int64_t h);
-#undef openremoteslide_cancel_prefetch_hint
-OPENREMOTESLIDE_PUBLIC()
-void openremoteslide_cancel_prefetch_hint(openremoteslide_t *osr, int prefetch_id);
+/* Prefetch */
+// decode prefetched tiles into the tile cache, rather than only fetching
+// their data into the I/O cache
+#define _OPENREMOTESLIDE_PREFETCH_DECODE_ENV_VAR "OPENREMOTESLIDE_PREFETCH_DECODE"
+#define _OPENREMOTESLIDE_PREFETCH_THREADS 2
 
 /* Prevent use of dangerous functions and functions with mandatory wrappers.
    Every @p replacement must be unique to avoid conflicting-type errors. */
@@ -3,39 +3,126 @@
 #define OPENREMOTESLIDE_OPENREMOTESLIDE_URL_H_
 
 #define THREAD_NUM 4
+/* persistent fetch workers shared by all open files */
+#define URLIO_WORKER_NUM (4*THREAD_NUM)
 #define THREAD_CACHE_SIZE (256*1024)
 #define CACHE_SIZE (THREAD_NUM*THREAD_CACHE_SIZE)
 #define RETRY_TIMES 10
-#define URLIO_VERBOSE
+/* default byte budget of the shared block cache; the environment variable
+ * gives the budget in MB */
+#define URLIO_BLOCK_CACHE_CAPACITY (256*1024*1024)
+#define URLIO_BLOCK_CACHE_ENV_VAR "OPENREMOTESLIDE_URLIO_CACHE_MB"
+/* idle connections kept by the shared pool, and default cap on concurrent
+ * transfers to one host (0 = unlimited); the environment variable overrides
+ * the cap */
+#define URLIO_MAX_CONNECTIONS (2*URLIO_WORKER_NUM)
+#define URLIO_MAX_HOST_CONNECTIONS URLIO_WORKER_NUM
+#define URLIO_HOST_CONNECTIONS_ENV_VAR "OPENREMOTESLIDE_URLIO_HOST_CONNECTIONS"
+/* per-host tuning: transfers in flight start at URLIO_TUNE_START_CONNECTIONS
+ * and move within [MIN, the cap above] every URLIO_TUNE_WINDOW requests;
+ * block misses are split into 1..URLIO_MAX_SLICES ranges of at least
+ * URLIO_MIN_SLICE_SIZE bytes once URLIO_TUNE_MIN_SAMPLES requests are
+ * measured.  "0" in the tuning variable fixes the cap and THREAD_NUM
+ * slices; the slices variable fixes just the slices. */
+#define URLIO_TUNE_ENV_VAR "OPENREMOTESLIDE_URLIO_TUNE"
+#define URLIO_SLICES_ENV_VAR "OPENREMOTESLIDE_URLIO_SLICES"
+#define URLIO_TUNE_START_CONNECTIONS 8
+#define URLIO_TUNE_MIN_CONNECTIONS 2
+#define URLIO_TUNE_MAX_CONNECTIONS 64
+#define URLIO_TUNE_WINDOW 32
+#define URLIO_TUNE_MIN_SAMPLES 8
+#define URLIO_TUNE_ALPHA 0.2
+#define URLIO_MAX_SLICES 16
+#define URLIO_MIN_SLICE_SIZE (64*1024)
+/* "1" multiplexes range requests over HTTP/2 (negotiated via TLS ALPN),
+ * "prior-knowledge" also speaks HTTP/2 to plain http:// servers */
+#define URLIO_HTTP2_ENV_VAR "OPENREMOTESLIDE_URLIO_HTTP2"
+/* setting the directory environment variable enables a persistent block
+ * cache shared across processes; its default budget is overridden in MB,
+ * and eviction trims it to this percentage of the budget */
+#define URLIO_DISK_CACHE_DIR_ENV_VAR "OPENREMOTESLIDE_URLIO_DISK_CACHE_DIR"
+#define URLIO_DISK_CACHE_ENV_VAR "OPENREMOTESLIDE_URLIO_DISK_CACHE_MB"
+#define URLIO_DISK_CACHE_CAPACITY (10ULL*1024*1024*1024)
+#define URLIO_DISK_CACHE_LOW_WATER 90
+/* largest entry read from or written to the disk cache; blocks and ranges
+ * are at most CACHE_SIZE, file indexes can be more */
+#define URLIO_DISK_CACHE_MAX_ENTRY (64*1024*1024)
+/* cap on the sequential readahead window, overridden in MB by the
+ * environment variable (0 disables readahead), and the threads issuing it */
+#define URLIO_READAHEAD_MAX (16*CACHE_SIZE)
+#define URLIO_READAHEAD_ENV_VAR "OPENREMOTESLIDE_URLIO_READAHEAD_MB"
+#define URLIO_READAHEAD_THREADS (URLIO_WORKER_NUM/THREAD_NUM/2)
+/* exact ranges closer than this many bytes are fetched in one request */
+#define URLIO_RANGE_GAP (16*1024)
+/* most ranges asked for in one multipart/byteranges request */
+#define URLIO_MULTIPART_RANGES 64
+/* seconds to connect, and at most per request; a transfer slower than
+ * URLIO_LOW_SPEED_LIMIT bytes/sec for URLIO_LOW_SPEED_TIME seconds is
+ * abandoned and retried */
+#define URLIO_CONNECT_TIMEOUT 10
+#define URLIO_REQUEST_TIMEOUT 60
+#define URLIO_LOW_SPEED_LIMIT 1024
+#define URLIO_LOW_SPEED_TIME 10
+/* retries wait a random time below an exponentially growing bound (ms) */
+#define URLIO_BACKOFF_BASE 50
+#define URLIO_BACKOFF_MAX 2000
+/* "1" sends a second copy of a range request still unanswered after the
+ * 95th percentile latency of the last URLIO_HEDGE_SAMPLES requests */
+#define URLIO_HEDGE_ENV_VAR "OPENREMOTESLIDE_URLIO_HEDGE"
+#define URLIO_HEDGE_SAMPLES 64
+#define URLIO_HEDGE_MIN_DELAY 10
+/* define URLIO_VERBOSE to trace every open, fetch and retry on stdout */
+/* #define URLIO_VERBOSE */
 #define CURL_VERBOSE 0L
 
-//// #define MAX_SURVIVAL_TIME 300
+/* seconds an unopened remote handle and its blocks are kept before the
+ * reaper frees them (0 = until urlio_frelease); the environment variable
+ * overrides it */
+#define URLIO_IDLE_TTL 300
+#define URLIO_IDLE_TTL_ENV_VAR "OPENREMOTESLIDE_URLIO_IDLE_TTL"
+
+/* "1" keeps an index of each parsed remote file with its blocks, so a
+ * reopen skips the parse; it persists if the disk cache is on */
+#define URLIO_INDEX_ENV_VAR "OPENREMOTESLIDE_URLIO_INDEX"
 
 #include <curl/curl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 enum fcurl_type_e {
 	CFTYPE_NONE = 0, CFTYPE_FILE = 1, CFTYPE_CURL = 2
 };
 
-struct fcurl_data_struct {
-	enum fcurl_type_e type; /* type of handle */
-	union {
-		CURL *curl;
-		FILE *file;
-	} handle; /* handle */
+struct urlio_fetch_request;
 
-	char *buffer; /* buffer to store cached data*/
-	size_t buffer_len; /* currently allocated buffers length */
-	size_t buffer_pos; /* end of data in buffer*/
-	int still_running; /* Is background url fetch still in progress */
+/* one range request handed to the fetch worker pool */
+struct fcurl_data_struct {
+	size_t buffer_pos; /* bytes delivered into cache so far */
 
-	char *url;
+	char *url; /* borrowed from the owning URLIO_FILE */
 	long int pos;
 	size_t size;
 	size_t want;
 	char *cache;
 	int tid;
-	CURLM *multi_handle;
+	struct urlio_fetch_request *request; /* completion to signal */
+
+	CURL *curl; /* handle of the worker running this job */
+	size_t skip; /* leading bytes to drop when the server ignored Range */
+	bool checked; /* response code inspected for this attempt */
+	int attempt;
+	CURLcode result; /* of the last attempt */
+	long code; /* HTTP status of the last attempt, 0 if none */
+
+	gint64 started; /* monotonic time the current attempt began */
+	gint64 deadline; /* monotonic time to give up at, 0 for none */
+	gint64 retry_at; /* monotonic time of the next attempt, if delayed */
+	gint cancelled; /* atomic; aborts the transfer */
+	struct fcurl_data_struct *twin; /* hedge of this job, or its original */
+	bool done; /* under the request lock */
+	bool good; /* some data, and not cancelled */
+	bool complete; /* everything wanted */
 };
 
 typedef struct fcurl_data_struct FCURL_DATA;
@@ -47,28 +134,53 @@ struct URLIO_FILE_struct {
 		FILE *file;
 	} handle; /* handle */
 
-	char *buffer; /* buffer to store cached data*/
-	size_t buffer_len; /* currently allocated buffers length */
-	size_t buffer_pos; /* end of data in buffer*/
-	int still_running; /* Is background url fetch still in progress */
-
-	FCURL_DATA *fcurl_data[THREAD_NUM];
-
 	char *url;
 	long int pos;
 	size_t size;
-
-	CURLM *multi_handle;
-
-	char **cache_list;
-	long int *cache_id_list;
-	int cache_count;
-	// int cacheLifeSpan;
+	bool accept_ranges; /* server answered a Range request with 206 */
+
+	bool eof_flag; /* a read hit end of file */
+	bool error_flag; /* a read failed to fetch its data */
+
+	/* validators from the server; the disk cache only trusts files that
+	 * have one */
+	char *etag;
+	char *last_modified;
+	char *disk_key; /* NULL if blocks aren't cached on disk */
+	gint multipart; /* multi-range requests: <0 refused, >0 work; atomic */
+
+	/* readahead state, under its lock */
+	int64_t ra_last; /* block of the previous read */
+	int64_t ra_issued; /* block after the last one requested ahead */
+	int ra_window; /* blocks requested ahead at a time */
+
+	/* registry state, under its lock */
+	int refcount; /* opens not yet closed */
+	gint64 idle_since; /* monotonic time of the last close */
+	bool release_flag; /* free at the last close */
 	bool close_flag;
 };
 
 typedef struct URLIO_FILE_struct URLIO_FILE;
 
+/* what the tuner has measured and chosen for one host */
+struct urlio_host_stats {
+	char host[256];
+	double rtt_ms; /* moving average time to first byte */
+	double rate_mb_s; /* moving average rate of one transfer */
+	int slices; /* range requests per block miss */
+	int max_connections; /* transfers allowed in flight, 0 = unlimited */
+	uint64_t requests;
+	uint64_t bytes;
+};
+
+/* a downloaded CACHE_SIZE block; len is short only at end of file */
+struct urlio_block {
+	gint refcount; /* atomic ops only */
+	char *data;
+	size_t len;
+};
+
 /* exported functions */
 URLIO_FILE	*	urlio_fopen(const char *url, const char *operation);
 int 			urlio_fclose(URLIO_FILE *file);
@@ -82,4 +194,38 @@ void 			urlio_rewind(URLIO_FILE *file);
 long int 		urlio_ftell(URLIO_FILE * file);
 int 			urlio_fseek(URLIO_FILE * file, long int offset, int origin);
 int 			urlio_ferror(URLIO_FILE *file);
+size_t			urlio_fview(URLIO_FILE *file, size_t len, const char **data,
+						struct urlio_block **block);
+size_t			urlio_pread(URLIO_FILE *file, void *ptr, size_t len, long int offset);
+int64_t			urlio_fsize(URLIO_FILE *file);
+size_t			urlio_pview(URLIO_FILE *file, long int offset, size_t len,
+						const char **data, struct urlio_block **block);
+int				urlio_fprefetch(URLIO_FILE *file, long int offset, size_t len);
+size_t			urlio_pview_range(URLIO_FILE *file, long int offset, size_t len,
+						const char **data, struct urlio_block **block);
+int				urlio_fprefetch_ranges(URLIO_FILE *file, int count,
+						const int64_t *offsets, const int64_t *lengths);
+void			urlio_block_unref(struct urlio_block *block);
+size_t			urlio_get_cache_capacity(void);
+void			urlio_set_cache_capacity(size_t capacity_in_bytes);
+int				urlio_get_max_host_connections(void);
+void			urlio_set_max_host_connections(int max);
+bool			urlio_get_http2_multiplex(void);
+void			urlio_set_http2_multiplex(bool enabled);
+void			urlio_set_disk_cache(const char *dir, uint64_t capacity_in_bytes);
+void			urlio_set_tuning(bool enabled);
+void			urlio_set_slices(int slices);
+int				urlio_get_host_stats(struct urlio_host_stats *stats, int max_hosts);
+void			urlio_set_deadline(int64_t timeout_ms);
+bool			urlio_get_hedging(void);
+void			urlio_set_hedging(bool enabled);
+unsigned		urlio_get_idle_ttl(void);
+void			urlio_set_idle_ttl(unsigned seconds);
+bool			urlio_get_indexing(void);
+void			urlio_set_indexing(bool enabled);
+bool			urlio_fremote(URLIO_FILE *file);
+bool			urlio_findexable(URLIO_FILE *file);
+size_t			urlio_fget_index(URLIO_FILE *file, const char **data,
+						struct urlio_block **block);
+void			urlio_fput_index(URLIO_FILE *file, const void *data, size_t len);
 #endif
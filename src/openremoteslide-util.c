@@ -30,14 +30,14 @@
 #include <math.h>
 #include <errno.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <cairo.h>
+#include <unistd.h>
 
 // #include <sys/syscall.h>
 #define gettidv1() syscall(__NR_gettid)
 #define gettidv2() syscall(SYS_gettid)
 
-#undef HAVE_FCNTL
-
 #ifdef HAVE_FCNTL
 #include <unistd.h>
 #include <fcntl.h>
@@ -175,11 +175,11 @@ URLIO_FILE *_openremoteslide_fopen(const char *path, const char *mode, GError **
     return NULL;
   }
 
-  /* Unnecessary if FOPEN_CLOEXEC_FLAG is non-empty.  Not built on Windows. */
-/*
+  /* Unnecessary if FOPEN_CLOEXEC_FLAG is non-empty.  Not built on Windows.
+     Remote handles have no descriptor of their own. */
 #ifdef HAVE_FCNTL
-  if (!FOPEN_CLOEXEC_FLAG[0]) {
-    int fd = fileno(f);
+  if (!FOPEN_CLOEXEC_FLAG[0] && f->type == CFTYPE_FILE) {
+    int fd = fileno(f->handle.file);
     if (fd == -1) {
       _openremoteslide_io_error(err, "Couldn't fileno() %s", path);
       urlio_fclose(f);
@@ -198,7 +198,6 @@ URLIO_FILE *_openremoteslide_fopen(const char *path, const char *mode, GError **
     }
   }
 #endif
-*/
 
   return f;
 }
@@ -384,712 +383,2475 @@ void _openremoteslide_performance_warn_once(gint *warned_flag,
 /* we use a global one for convenience */
 // CURLM *multi_handle;
 
-/* curl calls this routine to get more data */
-static size_t write_callback(char *buffer, size_t size, size_t nitems,
-		void *userp) {
-	char *newbuff;
-	size_t rembuff;
+/* connection pool
+ *
+ * Every urlio transfer shares one CURLSH, so connections, DNS lookups and
+ * TLS sessions are reused across slides and worker threads.  The number of
+ * transfers in flight to any one host is capped separately, since a shared
+ * connection cache alone does not bound concurrency.
+ */
+static struct {
+	CURLSH *share;
+	GMutex locks[CURL_LOCK_DATA_LAST];
+
+	GMutex host_lock;
+	GCond host_cond;
+	GHashTable *host_active; /* host -> GINT_TO_POINTER(transfers) */
+	int max_host_connections; /* 0 means unlimited */
+} conn_pool;
+
+/* scheme://[user@]host[:port]/path -> newly allocated "host[:port]" */
+static char *conn_pool_host(const char *url) {
+	const char *start = strstr(url, "://");
+	start = start ? start + 3 : url;
+	const char *end = start + strcspn(start, "/?#");
+	const char *at = memchr(start, '@', end - start);
+	if (at)
+		start = at + 1;
+	return g_ascii_strdown(start, end - start);
+}
 
-	URLIO_FILE *url = (URLIO_FILE *) userp;
-	size *= nitems;
+/* per-host tuning
+ *
+ * Every completed range request updates moving averages of its host's
+ * time to first byte (roughly one round trip) and of the rate a single
+ * transfer reaches once data flows.  A block miss is split into slices of
+ * about one bandwidth-delay product each, so a low-latency store gets many
+ * small ranges and a distant one a few large ones.
+ *
+ * The number of transfers allowed in flight to the host is hill-climbed:
+ * after every URLIO_TUNE_WINDOW requests it keeps moving the same way if
+ * throughput rose, turns around if it fell, and drifts down when nothing
+ * changes.  urlio_set_max_host_connections() bounds it from above.
+ */
+struct tune_host {
+	double rtt; /* usec, moving average of time to first byte */
+	double rate; /* bytes/usec of one transfer, moving average */
+	int samples;
+	int limit; /* transfers allowed in flight */
+	int direction; /* +1 while growing limit, -1 while shrinking */
+
+	gint64 window_start;
+	guint64 window_bytes;
+	int window_count;
+	double last_throughput; /* bytes/usec over the previous window */
+
+	guint64 requests;
+	guint64 bytes;
+};
 
-	rembuff = url->buffer_len - url->buffer_pos; /* remaining space in buffer */
+static struct {
+	GMutex lock;
+	GHashTable *hosts; /* host -> struct tune_host */
+	bool enabled;
+	int slices; /* fixed slices per block miss, or 0 to adapt */
+} tune;
 
-	if (size > rembuff) {
-		/* not enough space in buffer */
-		newbuff = (char*)realloc(url->buffer, url->buffer_len + (size - rembuff));
-		if (newbuff == NULL) {
-			fprintf(stderr, "callback buffer grow failed\n");
-			size = rembuff;
-		} else {
-			/* realloc succeeded increase buffer size*/
-			url->buffer_len += size - rembuff;
-			url->buffer = newbuff;
-		}
-	}
+static void tune_init(void) {
+	static gsize initialized;
 
-	memcpy(&url->buffer[url->buffer_pos], buffer, size);
-	url->buffer_pos += size;
+	if (g_once_init_enter(&initialized)) {
+		tune.hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				g_free);
+		tune.enabled = true;
 
-	return size;
-}
+		const char *env = g_getenv(URLIO_TUNE_ENV_VAR);
+		if (env && !strcmp(env, "0")) {
+			tune.enabled = false;
+		}
+		env = g_getenv(URLIO_SLICES_ENV_VAR);
+		if (env) {
+			char *endptr;
+			guint64 slices = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0] && slices <= URLIO_MAX_SLICES) {
+				urlio_set_slices(slices);
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_SLICES_ENV_VAR, env);
+			}
+		}
 
-/* use to attempt to fill the read buffer up to requested number of bytes */
-static int fill_buffer(URLIO_FILE *file, size_t want) {
-	fd_set fdread;
-	fd_set fdwrite;
-	fd_set fdexcep;
-	struct timeval timeout;
-	int rc;
-	CURLMcode mc; /* curl_multi_fdset() return code */
+		g_once_init_leave(&initialized, 1);
+	}
+}
 
-	/* only attempt to fill buffer if transactions still running and buffer
-	 * doesn't exceed required size already
-	 */
-	if ((!file->still_running) || (file->buffer_pos > want))
-		return 0;
+// lock must be held
+static struct tune_host *tune_get_host(const char *host) {
+	struct tune_host *h = g_hash_table_lookup(tune.hosts, host);
+	if (h == NULL) {
+		h = g_new0(struct tune_host, 1);
+		h->limit = URLIO_TUNE_START_CONNECTIONS;
+		h->direction = 1;
+		g_hash_table_insert(tune.hosts, g_strdup(host), h);
+	}
+	return h;
+}
 
-	/* attempt to fill buffer */
-	do {
-		int maxfd = -1;
-		long curl_timeo = -1;
+/* the most the tuner may allow one host */
+static int tune_ceiling(void) {
+	int max = g_atomic_int_get(&conn_pool.max_host_connections);
+	return max > 0 ? max : URLIO_TUNE_MAX_CONNECTIONS;
+}
 
-		FD_ZERO(&fdread);
-		FD_ZERO(&fdwrite);
-		FD_ZERO(&fdexcep);
+/* transfers allowed in flight to host; 0 means unlimited */
+static int tune_limit(const char *host) {
+	tune_init();
 
-		/* set a suitable timeout to fail on */
-		timeout.tv_sec = 60; /* 1 minute */
-		timeout.tv_usec = 0;
+	int max = g_atomic_int_get(&conn_pool.max_host_connections);
 
-		curl_multi_timeout(file->multi_handle, &curl_timeo);
+	g_mutex_lock(&tune.lock);
+	int limit = max;
+	if (tune.enabled) {
+		limit = MIN(tune_get_host(host)->limit, tune_ceiling());
+	}
+	g_mutex_unlock(&tune.lock);
+	return limit;
+}
 
-		if (curl_timeo >= 0) {
-			timeout.tv_sec = curl_timeo / 1000;
-			if (timeout.tv_sec > 1)
-				timeout.tv_sec = 1;
-			else
-				timeout.tv_usec = (curl_timeo % 1000) * 1000;
+/* range requests to split a block miss on host into */
+static int tune_slices(const char *host) {
+	tune_init();
+
+	g_mutex_lock(&tune.lock);
+	int slices = tune.slices;
+	if (slices == 0 && !tune.enabled) {
+		slices = THREAD_NUM;
+	} else if (slices == 0) {
+		struct tune_host *h = tune_get_host(host);
+		slices = THREAD_NUM;
+		if (h->samples >= URLIO_TUNE_MIN_SAMPLES) {
+			double bdp = MAX(h->rate * h->rtt, URLIO_MIN_SLICE_SIZE);
+			int want = MAX(CACHE_SIZE / bdp, 1);
+			/* the largest power of two not above want; the connection
+			 * limit below and urlio_set_slices() may still leave a
+			 * count that doesn't divide the block */
+			for (slices = 1; slices * 2 <= MIN(want, URLIO_MAX_SLICES); slices *= 2);
 		}
+		slices = MIN(slices, MAX(h->limit, 1));
+	}
+	g_mutex_unlock(&tune.lock);
+	return slices;
+}
 
-		/* get file descriptors from the transfers */
-		mc = curl_multi_fdset(file->multi_handle, &fdread, &fdwrite, &fdexcep,
-				&maxfd);
+/* account one finished transfer; true if the host may now run more */
+static bool tune_record(const char *url, CURL *curl, size_t bytes) {
+	curl_off_t pretransfer = 0, starttransfer = 0, total = 0;
+	curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+	char *host = conn_pool_host(url);
+	gint64 now = g_get_monotonic_time();
+	bool raised = false;
+
+	g_mutex_lock(&tune.lock);
+	struct tune_host *h = tune_get_host(host);
+	double rtt = MAX(starttransfer - pretransfer, 1);
+	double rate = bytes / (double) MAX(total - starttransfer, 1);
+	if (h->samples++ == 0) {
+		h->rtt = rtt;
+		h->rate = rate;
+	} else {
+		h->rtt += URLIO_TUNE_ALPHA * (rtt - h->rtt);
+		h->rate += URLIO_TUNE_ALPHA * (rate - h->rate);
+	}
+	h->requests++;
+	h->bytes += bytes;
 
-		if (mc != CURLM_OK) {
-			fprintf(stderr, "curl_multi_fdset() failed, code %d.\n", mc);
-			break;
+	if (h->window_count++ == 0) {
+		h->window_start = now - MAX(total, 1);
+	}
+	h->window_bytes += bytes;
+	if (tune.enabled && h->window_count >= URLIO_TUNE_WINDOW) {
+		double throughput = h->window_bytes /
+				(double) MAX(now - h->window_start, 1);
+		if (h->last_throughput > 0) {
+			if (throughput < h->last_throughput * 0.95) {
+				h->direction = -h->direction;
+			} else if (throughput < h->last_throughput * 1.05) {
+				h->direction = -1;
+			}
 		}
+		int old = h->limit;
+		h->limit = CLAMP(h->limit + h->direction * MAX(h->limit / 4, 1),
+				URLIO_TUNE_MIN_CONNECTIONS, tune_ceiling());
+		raised = h->limit > old;
+		h->last_throughput = throughput;
+		h->window_count = 0;
+		h->window_bytes = 0;
+	}
+	g_mutex_unlock(&tune.lock);
 
-		/* On success the value of maxfd is guaranteed to be >= -1. We call
-		 select(maxfd + 1, ...); specially in case of (maxfd == -1) there are
-		 no fds ready yet so we call select(0, ...) --or Sleep() on Windows--
-		 to sleep 100ms, which is the minimum suggested value in the
-		 curl_multi_fdset() doc. */
+	g_free(host);
+	return raised;
+}
 
-		if (maxfd == -1) {
-#ifdef _WIN32
-			Sleep(100);
-			rc = 0;
-#else
-			/* Portable sleep for platforms other than Windows. */
-			struct timeval wait = { 0, 100 * 1000 }; /* 100ms */
-			rc = select(0, NULL, NULL, NULL, &wait);
-#endif
-		} else {
-			/* Note that on some platforms 'timeout' may be modified by select().
-			 If you need access to the original value save a copy beforehand. */
-			rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
-		}
+void urlio_set_slices(int slices) {
+	g_mutex_lock(&tune.lock);
+	tune.slices = CLAMP(slices, 0, URLIO_MAX_SLICES);
+	g_mutex_unlock(&tune.lock);
+}
 
-		switch (rc) {
-		case -1:
-			/* select error */
-			break;
+void urlio_set_tuning(bool enabled) {
+	tune_init();
 
-		case 0:
-		default:
-			/* timeout or readable/writable sockets */
+	g_mutex_lock(&tune.lock);
+	tune.enabled = enabled;
+	g_mutex_unlock(&tune.lock);
+}
 
-			curl_multi_perform(file->multi_handle, &file->still_running);
-			break;
+/* Fill in up to max_hosts entries describing the hosts seen so far and
+ * the parameters chosen for them; returns the number of hosts. */
+int urlio_get_host_stats(struct urlio_host_stats *stats, int max_hosts) {
+	tune_init();
+
+	g_mutex_lock(&tune.lock);
+	GHashTableIter iter;
+	gpointer key, value;
+	int count = 0;
+	g_hash_table_iter_init(&iter, tune.hosts);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		if (count < max_hosts) {
+			struct tune_host *h = value;
+			struct urlio_host_stats *st = &stats[count];
+			g_strlcpy(st->host, key, sizeof(st->host));
+			st->rtt_ms = h->rtt / 1000;
+			st->rate_mb_s = h->rate * 1e6 / (1024 * 1024);
+			st->requests = h->requests;
+			st->bytes = h->bytes;
+			st->max_connections = tune.enabled ?
+					MIN(h->limit, tune_ceiling()) : conn_pool.max_host_connections;
 		}
-	} while (file->still_running && (file->buffer_pos < want));
-	return 1;
-}
+		count++;
+	}
+	g_mutex_unlock(&tune.lock);
 
-/* use to attempt to fill the read buffer up to requested number of bytes */
-static int fill_buffer_thread(FCURL_DATA *data, size_t want) {
-	fd_set fdread;
-	fd_set fdwrite;
-	fd_set fdexcep;
-	struct timeval timeout;
-	int rc;
-	CURLMcode mc; /* curl_multi_fdset() return code */
+	/* outside the lock, since tune_slices takes it */
+	for (int i = 0; i < MIN(count, max_hosts); i++) {
+		stats[i].slices = tune_slices(stats[i].host);
+	}
+	return count;
+}
 
-	/* only attempt to fill buffer if transactions still running and buffer
-	 * doesn't exceed required size already
-	 */
-	if ((!data->still_running) || (data->buffer_pos > want))
-		return 0;
+static void conn_pool_lock(CURL *handle G_GNUC_UNUSED, curl_lock_data data,
+		curl_lock_access access G_GNUC_UNUSED, void *userptr G_GNUC_UNUSED) {
+	g_mutex_lock(&conn_pool.locks[data]);
+}
 
-	/* attempt to fill buffer */
-	do {
-		int maxfd = -1;
-		long curl_timeo = -1;
+static void conn_pool_unlock(CURL *handle G_GNUC_UNUSED, curl_lock_data data,
+		void *userptr G_GNUC_UNUSED) {
+	g_mutex_unlock(&conn_pool.locks[data]);
+}
 
-		FD_ZERO(&fdread);
-		FD_ZERO(&fdwrite);
-		FD_ZERO(&fdexcep);
+static void conn_pool_init(void) {
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		curl_global_init(CURL_GLOBAL_ALL);
+
+		conn_pool.share = curl_share_init();
+		curl_share_setopt(conn_pool.share, CURLSHOPT_LOCKFUNC, conn_pool_lock);
+		curl_share_setopt(conn_pool.share, CURLSHOPT_UNLOCKFUNC, conn_pool_unlock);
+		curl_share_setopt(conn_pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+		curl_share_setopt(conn_pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(conn_pool.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+		conn_pool.host_active = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, NULL);
+		conn_pool.max_host_connections = URLIO_MAX_HOST_CONNECTIONS;
+
+		const char *env = g_getenv(URLIO_HOST_CONNECTIONS_ENV_VAR);
+		if (env) {
+			char *endptr;
+			guint64 max = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0] && max <= G_MAXINT) {
+				conn_pool.max_host_connections = (int) max;
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_HOST_CONNECTIONS_ENV_VAR, env);
+			}
+		}
 
-		/* set a suitable timeout to fail on */
-		timeout.tv_sec = 60; /* 1 minute */
-		timeout.tv_usec = 0;
+		g_once_init_leave(&initialized, 1);
+	}
+}
 
-		curl_multi_timeout(data->multi_handle, &curl_timeo);
+/* apply the pool settings; needed again after every curl_easy_reset() */
+static void conn_pool_setup(CURL *curl) {
+	curl_easy_setopt(curl, CURLOPT_SHARE, conn_pool.share);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, (long) URLIO_MAX_CONNECTIONS);
+}
 
-		if (curl_timeo >= 0) {
-			timeout.tv_sec = curl_timeo / 1000;
-			if (timeout.tv_sec > 1)
-				timeout.tv_sec = 1;
-			else
-				timeout.tv_usec = (curl_timeo % 1000) * 1000;
+/* wait for a free transfer slot on the host of url; returns the host key
+ * to pass to conn_pool_release(), or NULL if deadline (0 for none) passes
+ * or *cancelled (if given) is set first */
+static char *conn_pool_acquire(const char *url, gint64 deadline,
+		volatile gint *cancelled) {
+	char *host = conn_pool_host(url);
+
+	g_mutex_lock(&conn_pool.host_lock);
+	int active, limit;
+	while (active = GPOINTER_TO_INT(g_hash_table_lookup(conn_pool.host_active,
+			host)), limit = tune_limit(host), limit > 0 && active >= limit) {
+		if (!deadline && !cancelled) {
+			g_cond_wait(&conn_pool.host_cond, &conn_pool.host_lock);
+			continue;
 		}
 
-		/* get file descriptors from the transfers */
-		mc = curl_multi_fdset(data->multi_handle, &fdread, &fdwrite, &fdexcep,
-				&maxfd);
-
-		if (mc != CURLM_OK) {
-			fprintf(stderr, "curl_multi_fdset() failed, code %d.\n", mc);
-			break;
+		/* nobody signals a cancel, so look at it now and then */
+		gint64 now = g_get_monotonic_time();
+		if ((deadline && now >= deadline) ||
+				(cancelled && g_atomic_int_get(cancelled))) {
+			g_mutex_unlock(&conn_pool.host_lock);
+			g_free(host);
+			return NULL;
 		}
-
-		/* On success the value of maxfd is guaranteed to be >= -1. We call
-		 select(maxfd + 1, ...); specially in case of (maxfd == -1) there are
-		 no fds ready yet so we call select(0, ...) --or Sleep() on Windows--
-		 to sleep 100ms, which is the minimum suggested value in the
-		 curl_multi_fdset() doc. */
-
-		if (maxfd == -1) {
-#ifdef _WIN32
-			Sleep(100);
-			rc = 0;
-#else
-			/* Portable sleep for platforms other than Windows. */
-			struct timeval wait = { 0, 100 * 1000 }; /* 100ms */
-			rc = select(0, NULL, NULL, NULL, &wait);
-#endif
-		} else {
-			/* Note that on some platforms 'timeout' may be modified by select().
-			 If you need access to the original value save a copy beforehand. */
-			rc = select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
+		gint64 wake = cancelled ? now + 50000 : deadline;
+		if (deadline) {
+			wake = MIN(wake, deadline);
 		}
+		g_cond_wait_until(&conn_pool.host_cond, &conn_pool.host_lock, wake);
+	}
+	g_hash_table_insert(conn_pool.host_active, g_strdup(host),
+			GINT_TO_POINTER(active + 1));
+	g_mutex_unlock(&conn_pool.host_lock);
 
-		switch (rc) {
-		case -1:
-			/* select error */
-			break;
-
-		case 0:
-		default:
-			/* timeout or readable/writable sockets */
-
-			curl_multi_perform(data->multi_handle, &data->still_running);
-			break;
-		}
-	} while (data->still_running && (data->buffer_pos < want));
-	return 1;
+	return host;
 }
 
-/* use to remove want bytes from the front of a files buffer */
-static int use_buffer(URLIO_FILE *file, size_t want) {
-	/* sort out buffer */
-	if ((file->buffer_pos - want) <= 0) {
-		/* ditch buffer - write will recreate */
-		free(file->buffer);
-		file->buffer = NULL;
-		file->buffer_pos = 0;
-		file->buffer_len = 0;
-	} else {
-		/* move rest down make it available for later */
-		memmove(file->buffer, &file->buffer[want], (file->buffer_pos - want));
-
-		file->buffer_pos -= want;
-	}
-	return 0;
+/* let waiters recheck the limits */
+static void conn_pool_wake(void) {
+	g_mutex_lock(&conn_pool.host_lock);
+	g_cond_broadcast(&conn_pool.host_cond);
+	g_mutex_unlock(&conn_pool.host_lock);
 }
 
-/* use to remove want bytes from the front of a files buffer */
-static int use_buffer_thread(FCURL_DATA *data, size_t want) {
-	/* sort out buffer */
-	if ((data->buffer_pos - want) <= 0) {
-		/* ditch buffer - write will recreate */
-		free(data->buffer);
-		data->buffer = NULL;
-		data->buffer_pos = 0;
-		data->buffer_len = 0;
+static void conn_pool_release(char *host) {
+	g_mutex_lock(&conn_pool.host_lock);
+	int active = GPOINTER_TO_INT(g_hash_table_lookup(conn_pool.host_active,
+			host)) - 1;
+	if (active > 0) {
+		g_hash_table_insert(conn_pool.host_active, g_strdup(host),
+				GINT_TO_POINTER(active));
 	} else {
-		/* move rest down make it available for later */
-		memmove(data->buffer, &data->buffer[want], (data->buffer_pos - want));
-
-		data->buffer_pos -= want;
+		g_hash_table_remove(conn_pool.host_active, host);
 	}
-	return 0;
-}
-
-// static GThread *ghousekeepingthread = NULL;
-// static GMutex cache_lock;
-static URLIO_FILE **url_cache = NULL;
-static long int url_cache_count = 0;
-// static bool curl_global_inited = false;
+	g_cond_broadcast(&conn_pool.host_cond);
+	g_mutex_unlock(&conn_pool.host_lock);
 
-//static void *housekeepingthread_old(void *data) {
-//	for (;;) {
-//		sleep(1);
-//		// g_mutex_lock(&cache_lock);
-//
-//		for (int count = 0; count < url_cache_count; count++) {
-//			if (url_cache[count]->close_flag) {
-//				if(url_cache[count]->cacheLifeSpan > 0) url_cache[count]->cacheLifeSpan -= 1;
-//			}
-//			else {
-//				url_cache[count]->cacheLifeSpan = MAX_SURVIVAL_TIME;
-//			}
-//
-//			if (url_cache[count]->cacheLifeSpan == 0) {
-//
-//
-//
-//
-//				curl_multi_remove_handle(url_cache[count]->multi_handle,
-//						url_cache[count]->handle.curl);
-//
-//				/* cleanup */
-//				curl_easy_cleanup(url_cache[count]->handle.curl);
-//
-//				/* clean up multithread */
-//				for (int t = 0; t < THREAD_NUM; t ++) {
-//					/* if still_running is 0 now, we should return NULL */
-//
-//					/* make sure the easy handle is not in the multi handle anymore */
-//					curl_multi_remove_handle(url_cache[count]->fcurl_data[t]->multi_handle, url_cache[count]->fcurl_data[t]->handle.curl);
-//
-//					/* cleanup */
-//					curl_easy_cleanup(url_cache[count]->fcurl_data[t]->handle.curl);
-//
-//					free(url_cache[count]->fcurl_data[t]->buffer);/* free any allocated buffer space */
-//					free(url_cache[count]->fcurl_data[t]->url);
-//					free(url_cache[count]->fcurl_data[t]->cache);
-//					free(url_cache[count]->fcurl_data[t]);
-//
-//					url_cache[count]->fcurl_data[t] = NULL;
-//				}
-//
-//				free(url_cache[count]->buffer);/* free any allocated buffer space */
-//				free(url_cache[count]->url);
-//				if (url_cache[count]->cache_count != 0) {
-//					for (int i = 0; i < url_cache[count]->cache_count; i++)
-//						free(url_cache[count]->cache_list[i]);
-//					free(url_cache[count]->cache_list);
-//					free(url_cache[count]->cache_id_list);
-//				}
-//
-//				free(url_cache[count]);
-//
-//				url_cache[count] = NULL;
-//
-//				if (count != url_cache_count - 1)
-//					memmove(&url_cache[count], &url_cache[count + 1],
-//							(url_cache_count - count - 1) * sizeof(URLIO_FILE*));
-//				if (url_cache_count != 1) {
-//					url_cache = (URLIO_FILE**) realloc(url_cache,
-//							(url_cache_count - 1) * sizeof(URLIO_FILE*));
-//					url_cache_count--;
-//				} else {
-//					free(url_cache);
-//					url_cache = NULL;
-//					url_cache_count = 0;
-//				}
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//
-//			}
-//		}
-//
-//
-//		// if(url_cache_count == 0) {
-//		// 	ghousekeepingthread = NULL;
-//		// 	g_mutex_unlock(&cache_lock);
-//		// 	break;
-//		// }
-//		// else {
-//		// 	g_mutex_unlock(&cache_lock);
-//		// }
-//	}
-//}
+	g_free(host);
+}
 
+int urlio_get_max_host_connections(void) {
+	conn_pool_init();
 
-URLIO_FILE *urlio_fopen(const char *url, const char *operation) {
-	/* this code could check for URLs or types in the 'url' and
-	 basically use the real fopen() for standard files */
-#ifdef URLIO_VERBOSE
-	printf("fopen: %s\n", url);
-#endif
+	int max = g_atomic_int_get(&conn_pool.max_host_connections);
+	return max;
+}
 
+void urlio_set_max_host_connections(int max) {
+	conn_pool_init();
 
+	g_mutex_lock(&conn_pool.host_lock);
+	g_atomic_int_set(&conn_pool.max_host_connections, MAX(max, 0));
+	g_cond_broadcast(&conn_pool.host_cond);
+	g_mutex_unlock(&conn_pool.host_lock);
+}
 
+/* if line is "<name>: <value>", return the trimmed value, else NULL */
+static char *header_value(const char *line, size_t len, const char *name) {
+	size_t name_len = strlen(name);
+	if (len <= name_len || line[name_len] != ':' ||
+			g_ascii_strncasecmp(line, name, name_len) != 0)
+		return NULL;
+	return g_strstrip(g_strndup(line + name_len + 1, len - name_len - 1));
+}
 
+/* curl calls this routine for each response header line */
+static size_t header_callback(char *buffer, size_t size, size_t nitems,
+		void *userp) {
+	URLIO_FILE *url = (URLIO_FILE *) userp;
+	size *= nitems;
+	char *value;
+
+	if ((value = header_value(buffer, size, "content-range")) != NULL) {
+		/* bytes <first>-<last>/<length> */
+		long long first, last, length;
+		if (sscanf(value, "bytes %lld-%lld/%lld",
+				&first, &last, &length) == 3) {
+			url->size = length;
+		}
+		g_free(value);
+	} else if ((value = header_value(buffer, size, "etag")) != NULL) {
+		g_free(url->etag);
+		url->etag = value;
+	} else if ((value = header_value(buffer, size, "last-modified")) != NULL) {
+		g_free(url->last_modified);
+		url->last_modified = value;
+	} else if ((value = header_value(buffer, size, "accept-ranges")) != NULL) {
+		url->accept_ranges = !g_ascii_strcasecmp(value, "bytes");
+		g_free(value);
+	}
 
+	return size;
+}
 
+/* ask for exactly [start, end] rather than everything from start onward */
+static void set_range(CURL *curl, curl_off_t start, curl_off_t end) {
+	char range[64];
+	snprintf(range, sizeof(range),
+			"%" CURL_FORMAT_CURL_OFF_T "-%" CURL_FORMAT_CURL_OFF_T,
+			start, end);
+	curl_easy_setopt(curl, CURLOPT_RANGE, range);
+}
 
+/* per-thread read deadline, see urlio_set_deadline() */
+static GPrivate fetch_deadline = G_PRIVATE_INIT(g_free);
+
+/* Reads by the calling thread fail once timeout_ms milliseconds have
+ * passed from now, rather than wait out timeouts and retries.  0 clears
+ * the deadline.  Typically set before each request a tile server serves. */
+void urlio_set_deadline(int64_t timeout_ms) {
+	gint64 *deadline = g_private_get(&fetch_deadline);
+	if (deadline == NULL) {
+		deadline = g_new(gint64, 1);
+		g_private_set(&fetch_deadline, deadline);
+	}
+	*deadline = timeout_ms > 0 ?
+			g_get_monotonic_time() + timeout_ms * 1000 : 0;
+}
 
+/* the calling thread's deadline, or 0 */
+static gint64 fetch_get_deadline(void) {
+	gint64 *deadline = g_private_get(&fetch_deadline);
+	return deadline ? *deadline : 0;
+}
 
+/* block cache
+ *
+ * Downloaded CACHE_SIZE blocks are shared by every remote handle through
+ * one hash table keyed by (handle, block id).  The table is bounded by a
+ * byte budget and evicts from the tail of an LRU list.  Blocks are
+ * refcounted, so a reader holding a block is never affected by eviction.
+ */
 
+// hash table key
+struct urlio_block_key {
+	const URLIO_FILE *file;
+	int64_t id; /* block number, i.e. offset / CACHE_SIZE, or RANGE_ID */
+};
 
-	URLIO_FILE *file;
+/* exact byte ranges (see urlio_pview_range) are cached by their offset, in
+ * an id space disjoint from block numbers */
+#define RANGE_ID(offset) (-1 - (int64_t) (offset))
+/* below every RANGE_ID, see "file index" */
+#define INDEX_ID INT64_MIN
+#define IS_RANGE_ID(id) ((id) < 0 && (id) != INDEX_ID)
+
+/* cached ranges before an offset that a lookup checks for one covering it;
+ * more than one only matters where ranges overlap */
+#define RANGE_LOOKBACK 8
+
+// hash table value
+struct urlio_block_value {
+	GList *link; /* direct pointer to the node in the LRU list */
+	struct urlio_block_key *key; /* for removing keys when aged out */
+	struct urlio_block *block; /* may outlive the value */
+	GSequenceIter *range_link; /* node in the range index, for ranges */
+};
 
-	FILE *f;
+/* a download in progress; others needing the same key wait for it */
+struct urlio_inflight {
+	struct urlio_block_key key;
+	GCond cond;
+	bool done;
+	int waiters;
+	struct urlio_block *block; /* result, referenced for the waiters */
+};
 
+static struct {
+	GMutex lock;
+	GQueue *list;
+	GHashTable *hashtable;
+	GHashTable *inflight; /* urlio_block_key -> urlio_inflight */
+	GSequence *ranges; /* keys of cached ranges, by file and offset */
 
+	size_t capacity;
+	size_t total_size;
+} block_cache;
 
+static guint block_key_hash(gconstpointer key) {
+	const struct urlio_block_key *k = key;
 
+	return g_direct_hash(k->file) ^ (guint) (k->id ^ (k->id >> 32));
+}
 
+static gboolean block_key_equal(gconstpointer a, gconstpointer b) {
+	const struct urlio_block_key *k_a = a;
+	const struct urlio_block_key *k_b = b;
 
+	return k_a->file == k_b->file && k_a->id == k_b->id;
+}
 
-	f = fopen(url, operation);
-	if (f) {
-		file = (URLIO_FILE*)malloc(sizeof(URLIO_FILE));
+static void block_key_destroy(gpointer data) {
+	g_slice_free(struct urlio_block_key, data);
+}
 
-		if (!file) {
-			errno = EBADF;
-			// g_mutex_unlock(&cache_lock);
-			return NULL;
-		}
+/* orders range keys by file, then offset */
+static gint range_key_cmp(gconstpointer a, gconstpointer b,
+		gpointer user_data G_GNUC_UNUSED) {
+	const struct urlio_block_key *k_a = a;
+	const struct urlio_block_key *k_b = b;
+
+	if (k_a->file != k_b->file)
+		return (uintptr_t) k_a->file < (uintptr_t) k_b->file ? -1 : 1;
+	/* RANGE_ID runs backwards */
+	if (k_a->id != k_b->id)
+		return k_a->id > k_b->id ? -1 : 1;
+	return 0;
+}
 
-		memset(file, 0, sizeof(URLIO_FILE));
+// lock must be held
+static void block_value_destroy(gpointer data) {
+	struct urlio_block_value *value = data;
 
-		file->url = (char*) malloc((strlen(url)+1) * sizeof(char));
-		strcpy(file->url, url);
+	g_queue_delete_link(block_cache.list, value->link);
+	if (value->range_link) {
+		g_sequence_remove(value->range_link);
+	}
 
-		file->close_flag = false;
-		file->handle.file = f;
-		file->type = CFTYPE_FILE; /* marked as URL */
-	} else {
-		// g_mutex_lock(&cache_lock);
-
-		for (int i = 0; i < url_cache_count; i++) {
-			if (0 == strcmp(url_cache[i]->url, url)) {
-				file = url_cache[i];
-
-				/* halt transaction */
-				curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-				/* ditch buffer - write will recreate - resets stream pos*/
-				free(file->buffer);
-				file->buffer = NULL;
-				file->buffer_pos = 0;
-				file->buffer_len = 0;
-				file->pos = 0;
-
-				/* reset */
-				curl_easy_reset(file->handle.curl);
-				curl_easy_setopt(file->handle.curl, CURLOPT_URL, file->url);
-				curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-				curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-				curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION,
-						write_callback);
-				curl_easy_setopt(file->handle.curl, CURLOPT_RESUME_FROM_LARGE,
-						file->pos);
-
-				/* restart */
-				curl_multi_add_handle(file->multi_handle, file->handle.curl);
-				curl_multi_perform(file->multi_handle, &file->still_running);
-
-				file->close_flag = false;
-				// file->cacheLifeSpan = MAX_SURVIVAL_TIME;
-
-				if ((file->buffer_pos == 0) && (!file->still_running)) {
-					/* if still_running is 0 now, we should return NULL */
-
-					/* make sure the easy handle is not in the multi handle anymore */
-					curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-					/* cleanup */
-					curl_easy_cleanup(file->handle.curl);
-
-					free(file->buffer);/* free any allocated buffer space */
-					free(file->url);
-					if (file->cache_count != 0) {
-						for (int i = 0; i < file->cache_count; i++)
-							free(file->cache_list[i]);
-						free(file->cache_list);
-						free(file->cache_id_list);
-					}
-					free(file);
-
-					file = NULL;
-				}
+	g_assert(block_cache.total_size >= value->block->len);
+	block_cache.total_size -= value->block->len;
 
-				// g_mutex_unlock(&cache_lock);
+	urlio_block_unref(value->block);
+	g_slice_free(struct urlio_block_value, value);
+}
 
-				return file;
-			}
+// lock must be held
+static void block_cache_evict(size_t incoming_size) {
+	while (block_cache.total_size + incoming_size > block_cache.capacity) {
+		struct urlio_block_value *value = g_queue_peek_tail(block_cache.list);
+		if (value == NULL) {
+			return; /* cache is empty */
 		}
+		bool result = g_hash_table_remove(block_cache.hashtable, value->key);
+		g_assert(result);
+	}
+}
 
-		file = (URLIO_FILE*)malloc(sizeof(URLIO_FILE));
-
-		file->close_flag = false;
-
-		if (!file) {
-			errno = EBADF;
-			// g_mutex_unlock(&cache_lock);
-			return NULL;
+static void block_cache_init(void) {
+	static gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		block_cache.list = g_queue_new();
+		block_cache.ranges = g_sequence_new(NULL);
+		block_cache.hashtable = g_hash_table_new_full(block_key_hash,
+				block_key_equal, block_key_destroy, block_value_destroy);
+		block_cache.inflight = g_hash_table_new(block_key_hash,
+				block_key_equal);
+		block_cache.capacity = URLIO_BLOCK_CACHE_CAPACITY;
+
+		const char *env = g_getenv(URLIO_BLOCK_CACHE_ENV_VAR);
+		if (env) {
+			char *endptr;
+			guint64 mb = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0]) {
+				block_cache.capacity = (size_t) mb << 20;
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_BLOCK_CACHE_ENV_VAR, env);
+			}
 		}
 
-		memset(file, 0, sizeof(URLIO_FILE));
+		g_once_init_leave(&initialized, 1);
+	}
+}
 
+// lock must be held
+static struct urlio_block *block_cache_lookup(const struct urlio_block_key *key) {
+	struct urlio_block_value *value =
+			g_hash_table_lookup(block_cache.hashtable, key);
+	if (value == NULL) {
+		return NULL;
+	}
 
+	/* move to front of LRU list */
+	g_queue_unlink(block_cache.list, value->link);
+	g_queue_push_head_link(block_cache.list, value->link);
 
-		file->type = CFTYPE_CURL; /* marked as URL */
-		file->handle.curl = curl_easy_init();
+	struct urlio_block *block = value->block;
+	g_atomic_int_inc(&block->refcount);
+	return block;
+}
 
-		file->url = (char*) malloc((strlen(url)+1) * sizeof(char));
-		strcpy(file->url, url);
+/* returns a new reference, or NULL on miss */
+static struct urlio_block *block_cache_get(const URLIO_FILE *file, int64_t id) {
+	struct urlio_block_key key = { .file = file, .id = id };
 
-		curl_easy_setopt(file->handle.curl, CURLOPT_URL, url);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-		curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION,
-				write_callback);
+	g_mutex_lock(&block_cache.lock);
+	struct urlio_block *block = block_cache_lookup(&key);
+	g_mutex_unlock(&block_cache.lock);
 
-		if (!file->multi_handle)
-			file->multi_handle = curl_multi_init();
+	return block;
+}
 
-		curl_multi_add_handle(file->multi_handle, file->handle.curl);
+/* Single-flight for cache misses.  Returns NULL if the caller should fetch
+ * the entry itself and then call inflight_end(); otherwise someone else
+ * already had it or was fetching it, and *block is set to their result
+ * (NULL if their fetch failed). */
+static struct urlio_inflight *inflight_begin(const URLIO_FILE *file,
+		int64_t id, struct urlio_block **block) {
+	struct urlio_block_key key = { .file = file, .id = id };
+
+	g_mutex_lock(&block_cache.lock);
+	/* it may have landed since the caller's lookup */
+	*block = block_cache_lookup(&key);
+	if (*block) {
+		g_mutex_unlock(&block_cache.lock);
+		return NULL;
+	}
 
-		/* lets start the fetch */
-		curl_multi_perform(file->multi_handle, &file->still_running);
+	struct urlio_inflight *flight =
+			g_hash_table_lookup(block_cache.inflight, &key);
+	if (flight == NULL) {
+		flight = g_slice_new0(struct urlio_inflight);
+		flight->key = key;
+		g_cond_init(&flight->cond);
+		g_hash_table_insert(block_cache.inflight, &flight->key, flight);
+		g_mutex_unlock(&block_cache.lock);
+		return flight;
+	}
 
-		if ((file->buffer_pos == 0) && (!file->still_running)) {
-			/* if still_running is 0 now, we should return NULL */
+	/* wait no longer than our own deadline */
+	gint64 deadline = fetch_get_deadline();
+	flight->waiters++;
+	while (!flight->done) {
+		if (!deadline) {
+			g_cond_wait(&flight->cond, &block_cache.lock);
+		} else if (!g_cond_wait_until(&flight->cond, &block_cache.lock,
+				deadline)) {
+			break;
+		}
+	}
+	if (flight->done && flight->block) {
+		g_atomic_int_inc(&flight->block->refcount);
+		*block = flight->block;
+	}
+	/* the fetcher frees it if it hasn't finished */
+	bool last = --flight->waiters == 0 && flight->done;
+	g_mutex_unlock(&block_cache.lock);
+
+	if (last) {
+		if (flight->block)
+			urlio_block_unref(flight->block);
+		g_cond_clear(&flight->cond);
+		g_slice_free(struct urlio_inflight, flight);
+	}
+	return NULL;
+}
 
-			/* make sure the easy handle is not in the multi handle anymore */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
+/* publish the result of a fetch started by inflight_begin() to waiters;
+ * block may be NULL if the fetch failed */
+static void inflight_end(struct urlio_inflight *flight,
+		struct urlio_block *block) {
+	g_mutex_lock(&block_cache.lock);
+	g_hash_table_remove(block_cache.inflight, &flight->key);
+	flight->done = true;
+	bool waited = flight->waiters > 0;
+	if (waited) {
+		if (block)
+			g_atomic_int_inc(&block->refcount);
+		flight->block = block;
+		g_cond_broadcast(&flight->cond);
+	}
+	g_mutex_unlock(&block_cache.lock);
 
-			/* cleanup */
-			curl_easy_cleanup(file->handle.curl);
+	if (!waited) {
+		g_cond_clear(&flight->cond);
+		g_slice_free(struct urlio_inflight, flight);
+	}
+}
 
-			free(file->buffer);/* free any allocated buffer space */
-			free(file->url);
-			if (file->cache_count != 0) {
-				for (int i = 0; i < file->cache_count; i++)
-					free(file->cache_list[i]);
-				free(file->cache_list);
-				free(file->cache_id_list);
-			}
-			free(file);
+/* takes ownership of data (allocated with malloc) and returns a new
+ * reference to the resulting block; the block is still valid if the cache
+ * refused to keep it */
+static struct urlio_block *block_cache_put(const URLIO_FILE *file, int64_t id,
+		char *data, size_t len) {
+	struct urlio_block *block = g_slice_new(struct urlio_block);
+	g_atomic_int_set(&block->refcount, 1); /* one ref for the caller */
+	block->data = data;
+	block->len = len;
+
+	g_mutex_lock(&block_cache.lock);
+
+	/* don't try to put anything in the cache that cannot possibly fit */
+	if (len > block_cache.capacity) {
+		g_mutex_unlock(&block_cache.lock);
+		return block;
+	}
 
-			file = NULL;
-			errno = EBADF;
-		} else {
-			for (int retry = 0; retry < RETRY_TIMES; retry++) {
-				fill_buffer(file, 1);
-				if (file->buffer_pos)
-					break;
+	block_cache_evict(len);
 
-				/* halt transaction */
-				curl_multi_remove_handle(file->multi_handle, file->handle.curl);
+	struct urlio_block_key *key = g_slice_new(struct urlio_block_key);
+	key->file = file;
+	key->id = id;
 
-				/* ditch buffer - write will recreate - resets stream pos*/
-				free(file->buffer);
-				file->buffer = NULL;
-				file->buffer_pos = 0;
-				file->buffer_len = 0;
+	struct urlio_block_value *value = g_slice_new(struct urlio_block_value);
+	value->key = key;
+	value->block = block;
+	value->range_link = NULL;
+	if (IS_RANGE_ID(id)) {
+		value->range_link = g_sequence_insert_sorted(block_cache.ranges, key,
+				range_key_cmp, NULL);
+	}
 
-				/* restart */
-				curl_multi_add_handle(file->multi_handle, file->handle.curl);
+	g_queue_push_head(block_cache.list, value);
+	value->link = g_queue_peek_head_link(block_cache.list);
 
-				/* lets start the fetch again */
-				curl_multi_perform(file->multi_handle, &file->still_running);
-			}
+	/* replaces (and unrefs) any block fetched concurrently for this key */
+	g_hash_table_replace(block_cache.hashtable, key, value);
+	block_cache.total_size += len;
 
-			/* check if theres data in the buffer - if not fill_buffer()
-			 * either errored or EOF */
-			if (!file->buffer_pos) {
-				/* if still_running is 0 now, we should return NULL */
+	/* another ref for the cache */
+	g_atomic_int_inc(&block->refcount);
 
-				/* make sure the easy handle is not in the multi handle anymore */
-				curl_multi_remove_handle(file->multi_handle, file->handle.curl);
+	g_mutex_unlock(&block_cache.lock);
 
-				/* cleanup */
-				curl_easy_cleanup(file->handle.curl);
+	return block;
+}
 
-				free(file->buffer);/* free any allocated buffer space */
-				free(file->url);
-				if (file->cache_count != 0) {
-					for (int i = 0; i < file->cache_count; i++)
-						free(file->cache_list[i]);
-					free(file->cache_list);
-					free(file->cache_id_list);
-				}
-				free(file);
+static gboolean block_key_matches_file(gpointer key, gpointer value G_GNUC_UNUSED,
+		gpointer file) {
+	return ((struct urlio_block_key *) key)->file == file;
+}
 
-				file = NULL;
-				errno = EBADF;
-			}
+/* drop every cached block of a handle that is about to be freed */
+static void block_cache_purge(const URLIO_FILE *file) {
+	g_mutex_lock(&block_cache.lock);
+	g_hash_table_foreach_remove(block_cache.hashtable, block_key_matches_file,
+			(gpointer) file);
+	g_mutex_unlock(&block_cache.lock);
+}
 
-			double dSize;
-			curl_easy_getinfo(file->handle.curl,
-					CURLINFO_CONTENT_LENGTH_DOWNLOAD, &dSize);
-			file->size = (long) dSize;
-#ifdef URLIO_VERBOSE
-			printf("fopen: file length %zu\n", file->size);
-#endif
-			/* halt transaction */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* ditch buffer - write will recreate - resets stream pos*/
-			free(file->buffer);
-			file->buffer = NULL;
-			file->buffer_pos = 0;
-			file->buffer_len = 0;
-			file->pos = 0L;
-
-			/* reset */
-			curl_easy_reset(file->handle.curl);
-			curl_easy_setopt(file->handle.curl, CURLOPT_URL, file->url);
-			curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-			curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-			curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION,
-					write_callback);
-			curl_easy_setopt(file->handle.curl, CURLOPT_RESUME_FROM_LARGE,
-					file->pos);
-
-			/* restart */
-			curl_multi_add_handle(file->multi_handle, file->handle.curl);
-
-			/* lets start the fetch again */
-			curl_multi_perform(file->multi_handle, &file->still_running);
-
-			if ((file->buffer_pos == 0) && (!file->still_running)) {
-				/* if still_running is 0 now, we should return NULL */
-
-				/* make sure the easy handle is not in the multi handle anymore */
-				curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-				/* cleanup */
-				curl_easy_cleanup(file->handle.curl);
-
-				free(file->buffer);/* free any allocated buffer space */
-				free(file->url);
-				if (file->cache_count != 0) {
-					for (int i = 0; i < file->cache_count; i++)
-						free(file->cache_list[i]);
-					free(file->cache_list);
-					free(file->cache_id_list);
-				}
-				free(file);
+void urlio_block_unref(struct urlio_block *block) {
+	if (g_atomic_int_dec_and_test(&block->refcount)) {
+		free(block->data);
+		g_slice_free(struct urlio_block, block);
+	}
+}
 
-				file = NULL;
-				errno = EBADF;
-			}
-		}
+size_t urlio_get_cache_capacity(void) {
+	block_cache_init();
 
+	g_mutex_lock(&block_cache.lock);
+	size_t capacity = block_cache.capacity;
+	g_mutex_unlock(&block_cache.lock);
+	return capacity;
+}
 
-		if (file != NULL) {
-			// initial remote access for multuthread
+void urlio_set_cache_capacity(size_t capacity_in_bytes) {
+	block_cache_init();
 
-			memset(file->fcurl_data, 0, sizeof(file->fcurl_data));
+	g_mutex_lock(&block_cache.lock);
+	block_cache.capacity = capacity_in_bytes;
+	block_cache_evict(0);
+	g_mutex_unlock(&block_cache.lock);
+}
 
-			bool areAllThreadsSet = true;
+/* disk cache
+ *
+ * An optional second tier under the block cache, enabled by pointing
+ * URLIO_DISK_CACHE_DIR_ENV_VAR at a local directory.  Each remote file gets
+ * a directory named by a hash of its URL, validator (ETag, else
+ * Last-Modified) and size, holding one file per block.  Blocks are written
+ * to a temporary file and renamed into place, so several processes can
+ * share the directory and readers never see a partial block.  Files whose
+ * server gave no validator are never cached on disk.
+ *
+ * Eviction is LRU by mtime: hits touch the block, and when the usage we
+ * know of exceeds the budget the whole tree is rescanned and the oldest
+ * blocks are removed until it is back under URLIO_DISK_CACHE_LOW_WATER.
+ */
+static struct {
+	GMutex lock;
+	char *dir; /* NULL if disabled */
+	uint64_t capacity;
+	uint64_t total_size; /* estimate; resynced on every eviction scan */
+} disk_cache;
+
+struct disk_cache_entry {
+	char *path;
+	time_t mtime;
+	uint64_t size;
+};
 
-			for (int t = 0; t < THREAD_NUM; t ++) {
-				file->fcurl_data[t] = (FCURL_DATA*)malloc(sizeof(FCURL_DATA));
-				memset(file->fcurl_data[t], 0, sizeof(FCURL_DATA));
+static void disk_cache_scan(GArray *entries, const char *path, int depth) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	const char *name;
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		char *child = g_build_filename(path, name, NULL);
+		if (depth < 2) {
+			disk_cache_scan(entries, child, depth + 1);
+			g_free(child);
+			continue;
+		}
 
-				file->fcurl_data[t]->type = CFTYPE_CURL; /* marked as URL */
-				file->fcurl_data[t]->handle.curl = curl_easy_init();
-				file->fcurl_data[t]->tid = t;
-				file->fcurl_data[t]->size =file->size;
+		GStatBuf st;
+		if (g_stat(child, &st) == 0 && S_ISREG(st.st_mode)) {
+			struct disk_cache_entry entry = { child, st.st_mtime, st.st_size };
+			g_array_append_val(entries, entry);
+		} else {
+			g_free(child);
+		}
+	}
+	g_dir_close(dir);
 
-				file->fcurl_data[t]->url = (char*) malloc(strlen(url) * sizeof(char));
-				strcpy(file->fcurl_data[t]->url, url);
-				file->fcurl_data[t]->cache = (char*) malloc(THREAD_CACHE_SIZE * sizeof(char));
+	/* drop emptied slide directories; fails harmlessly otherwise */
+	if (depth == 2)
+		g_rmdir(path);
+}
 
-				curl_easy_setopt(file->fcurl_data[t]->handle.curl, CURLOPT_URL, file->url);
-				curl_easy_setopt(file->fcurl_data[t]->handle.curl, CURLOPT_WRITEDATA, file->fcurl_data[t]);
-				curl_easy_setopt(file->fcurl_data[t]->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-				curl_easy_setopt(file->fcurl_data[t]->handle.curl, CURLOPT_WRITEFUNCTION,
-						write_callback);
+static gint disk_cache_entry_cmp(gconstpointer a, gconstpointer b) {
+	const struct disk_cache_entry *ea = a;
+	const struct disk_cache_entry *eb = b;
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
 
-				file->fcurl_data[t]->multi_handle = curl_multi_init();
+/* call with disk_cache.lock held */
+static void disk_cache_evict(void) {
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(struct disk_cache_entry));
+	disk_cache_scan(entries, disk_cache.dir, 0);
+	g_array_sort(entries, disk_cache_entry_cmp);
+
+	uint64_t total = 0;
+	for (guint i = 0; i < entries->len; i++)
+		total += g_array_index(entries, struct disk_cache_entry, i).size;
+
+	uint64_t target = disk_cache.capacity / 100 * URLIO_DISK_CACHE_LOW_WATER;
+	for (guint i = 0; i < entries->len; i++) {
+		struct disk_cache_entry *entry =
+				&g_array_index(entries, struct disk_cache_entry, i);
+		if (total > target && g_unlink(entry->path) == 0)
+			total -= entry->size;
+		g_free(entry->path);
+	}
+	g_array_free(entries, TRUE);
 
-				curl_multi_add_handle(file->fcurl_data[t]->multi_handle, file->fcurl_data[t]->handle.curl);
+	disk_cache.total_size = total;
+}
 
-				/* lets start the fetch */
-				curl_multi_perform(file->fcurl_data[t]->multi_handle, &file->fcurl_data[t]->still_running);
+static void disk_cache_init(void) {
+	static gsize initialized = 0;
 
-				if ((file->fcurl_data[t]->buffer_pos == 0) && (!file->fcurl_data[t]->still_running)) {
-					areAllThreadsSet = false;
+	if (g_once_init_enter(&initialized)) {
+		const char *dir = g_getenv(URLIO_DISK_CACHE_DIR_ENV_VAR);
+		const char *env = g_getenv(URLIO_DISK_CACHE_ENV_VAR);
+		uint64_t capacity = URLIO_DISK_CACHE_CAPACITY;
 
-					break;
-				}
+		if (env) {
+			char *endptr;
+			guint64 mb = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0]) {
+				capacity = (uint64_t) mb << 20;
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_DISK_CACHE_ENV_VAR, env);
 			}
+		}
+		if (dir && dir[0]) {
+			urlio_set_disk_cache(dir, capacity);
+		}
 
-			if(!areAllThreadsSet) {
-				for (int t = 0; t < THREAD_NUM; t ++) {
-					/* if still_running is 0 now, we should return NULL */
+		g_once_init_leave(&initialized, 1);
+	}
+}
 
-					/* make sure the easy handle is not in the multi handle anymore */
-					curl_multi_remove_handle(file->fcurl_data[t]->multi_handle, file->fcurl_data[t]->handle.curl);
+void urlio_set_disk_cache(const char *dir, uint64_t capacity_in_bytes) {
+	g_mutex_lock(&disk_cache.lock);
+	g_free(disk_cache.dir);
+	disk_cache.dir = NULL;
+	disk_cache.capacity = capacity_in_bytes;
+
+	if (dir != NULL && g_mkdir_with_parents(dir, 0755) == 0) {
+		disk_cache.dir = g_strdup(dir);
+		/* learn the current usage, trimming if we are over budget */
+		disk_cache_evict();
+	} else if (dir != NULL) {
+		g_warning("Couldn't create disk cache directory %s: %s", dir,
+				g_strerror(errno));
+	}
+	g_mutex_unlock(&disk_cache.lock);
+}
 
-					/* cleanup */
-					curl_easy_cleanup(file->fcurl_data[t]->handle.curl);
+/* directory for file's blocks, or NULL if it can't be cached on disk */
+static char *disk_cache_key(URLIO_FILE *file) {
+	const char *validator = file->etag ? file->etag : file->last_modified;
+	if (validator == NULL || file->size == 0)
+		return NULL;
+
+	char *id = g_strdup_printf("%s\n%s\n%zu", file->url, validator,
+			file->size);
+	char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, id, -1);
+	char prefix[3] = { hash[0], hash[1], 0 };
+	char *key = g_build_filename(prefix, hash, NULL);
+	g_free(hash);
+	g_free(id);
+	return key;
+}
 
-					free(file->fcurl_data[t]->buffer);/* free any allocated buffer space */
-					free(file->fcurl_data[t]);
+/* return malloc'd contents of the block, or NULL */
+static char *disk_cache_get(URLIO_FILE *file, int64_t block_id, size_t *len) {
+	if (file->disk_key == NULL)
+		return NULL;
+
+	g_mutex_lock(&disk_cache.lock);
+	char *path = NULL;
+	if (disk_cache.dir) {
+		char name[32];
+		g_snprintf(name, sizeof(name), "%" PRId64, block_id);
+		path = g_build_filename(disk_cache.dir, file->disk_key, name, NULL);
+	}
+	g_mutex_unlock(&disk_cache.lock);
+	if (path == NULL)
+		return NULL;
+
+	char *data = NULL;
+	FILE *f = g_fopen(path, "rb");
+	struct stat st;
+	if (f && fstat(fileno(f), &st) == 0 && st.st_size > 0 &&
+			st.st_size <= URLIO_DISK_CACHE_MAX_ENTRY) {
+		data = (char*) malloc(st.st_size * sizeof(char));
+		if (data) {
+			*len = fread(data, 1, st.st_size, f);
+		}
+		if (data && (ferror(f) || *len == 0)) {
+			free(data);
+			data = NULL;
+		}
+	}
+	if (f) {
+		fclose(f);
+	}
+
+	if (data) {
+		/* refresh LRU position */
+		g_utime(path, NULL);
+	}
+	g_free(path);
+	return data;
+}
+
+static void disk_cache_put(URLIO_FILE *file, int64_t block_id,
+		const char *data, size_t len) {
+	if (file->disk_key == NULL || len == 0 || len > URLIO_DISK_CACHE_MAX_ENTRY)
+		return;
+
+	g_mutex_lock(&disk_cache.lock);
+	if (disk_cache.dir == NULL) {
+		g_mutex_unlock(&disk_cache.lock);
+		return;
+	}
+	char *dir = g_build_filename(disk_cache.dir, file->disk_key, NULL);
+	g_mutex_unlock(&disk_cache.lock);
+
+	char name[32];
+	g_snprintf(name, sizeof(name), "%" PRId64, block_id);
+	char *path = g_build_filename(dir, name, NULL);
+	char *tmp = g_build_filename(dir, ".tmp-XXXXXX", NULL);
+	bool ok = false;
+
+	if (g_mkdir_with_parents(dir, 0755) == 0) {
+		int fd = g_mkstemp(tmp);
+		if (fd != -1) {
+			FILE *f = fdopen(fd, "wb");
+			if (f) {
+				ok = fwrite(data, 1, len, f) == len;
+				ok = (fclose(f) == 0) && ok;
+			} else {
+				close(fd);
+			}
+			/* atomic publish; a concurrent writer of the same block wins
+			 * or loses harmlessly */
+			if (!ok || g_rename(tmp, path) != 0) {
+				g_unlink(tmp);
+				ok = false;
+			}
+		}
+	}
+
+	if (ok) {
+		g_mutex_lock(&disk_cache.lock);
+		disk_cache.total_size += len;
+		if (disk_cache.dir && disk_cache.total_size > disk_cache.capacity)
+			disk_cache_evict();
+		g_mutex_unlock(&disk_cache.lock);
+	}
+
+	g_free(tmp);
+	g_free(path);
+	g_free(dir);
+}
+
+/* fetch worker pool
+ *
+ * Cache misses are served by a fixed set of long-lived workers rather than
+ * by spawning THREAD_NUM threads per miss.  Each worker owns one easy handle
+ * for its whole lifetime, so DNS, TCP and TLS state survive from one range
+ * request to the next.
+ */
+static GThreadPool *fetch_pool;
+static GPrivate fetch_curl = G_PRIVATE_INIT((GDestroyNotify) curl_easy_cleanup);
+
+/* completion object for one block miss; lives on the requester's stack */
+struct urlio_fetch_request {
+	GMutex lock;
+	GCond cond;
+	int pending; /* jobs not yet finished */
+};
+
+/* timeouts, retries and hedging
+ *
+ * Every request has connect, low-speed and total timeouts.  Transient
+ * failures (timeouts, dropped connections, 5xx, 408 and 429) are retried
+ * with full-jitter backoff; other errors, such as a 404 or a bad URL, fail
+ * at once.  A thread may also set a deadline for its reads; jobs carry
+ * it to the workers, which shorten their timeouts and give up retrying
+ * rather than run past it.
+ *
+ * With hedging on, a requester whose jobs are still pending after the
+ * recent 95th percentile latency sends each of them again; whichever copy
+ * completes first cancels the other.
+ */
+static struct {
+	GMutex lock;
+	bool enabled;
+	gint64 samples[URLIO_HEDGE_SAMPLES]; /* latencies in usec, a ring */
+	int count;
+	int next;
+} hedge;
+
+static void hedge_init(void) {
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		const char *env = g_getenv(URLIO_HEDGE_ENV_VAR);
+		if (env && strcmp(env, "0")) {
+			urlio_set_hedging(true);
+		}
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+bool urlio_get_hedging(void) {
+	g_mutex_lock(&hedge.lock);
+	bool enabled = hedge.enabled;
+	g_mutex_unlock(&hedge.lock);
+	return enabled;
+}
+
+void urlio_set_hedging(bool enabled) {
+	g_mutex_lock(&hedge.lock);
+	hedge.enabled = enabled;
+	g_mutex_unlock(&hedge.lock);
+}
+
+static void hedge_record(gint64 latency) {
+	g_mutex_lock(&hedge.lock);
+	hedge.samples[hedge.next] = latency;
+	hedge.next = (hedge.next + 1) % URLIO_HEDGE_SAMPLES;
+	hedge.count = MIN(hedge.count + 1, URLIO_HEDGE_SAMPLES);
+	g_mutex_unlock(&hedge.lock);
+}
+
+static gint sample_cmp(gconstpointer a, gconstpointer b) {
+	gint64 sa = *(const gint64 *) a;
+	gint64 sb = *(const gint64 *) b;
+	return (sa > sb) - (sa < sb);
+}
+
+/* usec to wait before hedging, or 0 not to hedge */
+static gint64 hedge_delay(void) {
+	gint64 samples[URLIO_HEDGE_SAMPLES];
+
+	g_mutex_lock(&hedge.lock);
+	int count = hedge.count;
+	/* too few samples to say what is slow */
+	if (!hedge.enabled || count < URLIO_HEDGE_SAMPLES / 4) {
+		g_mutex_unlock(&hedge.lock);
+		return 0;
+	}
+	memcpy(samples, hedge.samples, count * sizeof(gint64));
+	g_mutex_unlock(&hedge.lock);
+
+	qsort(samples, count, sizeof(gint64), sample_cmp);
+	return MAX(samples[count * 95 / 100], URLIO_HEDGE_MIN_DELAY * 1000);
+}
+
+static int fetch_progress_callback(void *userp,
+		curl_off_t dltotal G_GNUC_UNUSED, curl_off_t dlnow G_GNUC_UNUSED,
+		curl_off_t ultotal G_GNUC_UNUSED, curl_off_t ulnow G_GNUC_UNUSED) {
+	FCURL_DATA *data = (FCURL_DATA *) userp;
+	/* nonzero aborts the transfer */
+	return g_atomic_int_get(&data->cancelled);
+}
+
+static void fetch_set_timeouts(CURL *curl, gint64 deadline) {
+	long timeout = URLIO_REQUEST_TIMEOUT * 1000L;
+	if (deadline) {
+		gint64 left = (deadline - g_get_monotonic_time()) / 1000;
+		timeout = CLAMP(left, 1, timeout);
+	}
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+			MIN(URLIO_CONNECT_TIMEOUT * 1000L, timeout));
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long) URLIO_LOW_SPEED_LIMIT);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) URLIO_LOW_SPEED_TIME);
+}
+
+/* usec to wait before retrying after the given attempt */
+static gint64 fetch_backoff_delay(int attempt) {
+	gint64 bound = MIN((gint64) URLIO_BACKOFF_BASE << MIN(attempt, 16),
+			URLIO_BACKOFF_MAX) * 1000;
+	return g_random_int_range(0, bound);
+}
+
+/* note how an attempt ended, for fetch_should_retry() */
+static void fetch_job_result(FCURL_DATA *data, CURL *curl, CURLcode result) {
+	data->result = result;
+	data->code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &data->code);
+}
+
+/* whether the last attempt failed in a way that may not happen again */
+static bool fetch_transient(FCURL_DATA *data) {
+	switch (data->result) {
+	case CURLE_HTTP_RETURNED_ERROR:
+		return data->code >= 500 || data->code == 408 || data->code == 429;
+	case CURLE_OK: /* a short body */
+	case CURLE_WRITE_ERROR: /* we stopped the transfer */
+	case CURLE_ABORTED_BY_CALLBACK:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_PARTIAL_FILE:
+	case CURLE_SSL_CONNECT_ERROR:
+	case CURLE_HTTP2:
+	case CURLE_HTTP2_STREAM:
+		return true;
+	default:
+		/* missing files, bad URLs, unknown hosts and the like */
+		return false;
+	}
+}
+
+/* whether a failed job should try again at retry_at */
+static bool fetch_should_retry(FCURL_DATA *data, gint64 retry_at) {
+	return !g_atomic_int_get(&data->cancelled) &&
+			fetch_transient(data) &&
+			data->attempt + 1 < RETRY_TIMES &&
+			(!data->deadline || retry_at < data->deadline);
+}
+
+/* sleep before the next attempt; false if the job should give up */
+static bool fetch_backoff(FCURL_DATA *data) {
+	gint64 retry_at = g_get_monotonic_time() + fetch_backoff_delay(data->attempt);
+	if (!fetch_should_retry(data, retry_at)) {
+		return false;
+	}
+
+	gint64 now;
+	while ((now = g_get_monotonic_time()) < retry_at) {
+		if (g_atomic_int_get(&data->cancelled)) {
+			return false;
+		}
+		g_usleep(MIN(retry_at - now, 50000));
+	}
+	return true;
+}
+
+/* curl calls this routine to deliver a range directly into the job cache */
+static size_t fetch_write_callback(char *buffer, size_t size, size_t nitems,
+		void *userp) {
+	FCURL_DATA *data = (FCURL_DATA *) userp;
+	size *= nitems;
+	size_t total = size;
+
+	if (g_atomic_int_get(&data->cancelled)) {
+		return 0;
+	}
+
+	if (!data->checked) {
+		/* a 200 means the server ignored Range and starts at byte 0 */
+		long code = 0;
+		curl_easy_getinfo(data->curl, CURLINFO_RESPONSE_CODE, &code);
+		data->skip = (code == 200) ? data->pos : 0;
+		data->checked = true;
+	}
+
+	if (data->skip) {
+		size_t drop = MIN(size, data->skip);
+		buffer += drop;
+		size -= drop;
+		data->skip -= drop;
+		if (size == 0)
+			return total;
+	}
+
+	size_t remaining = data->want - data->buffer_pos;
+	size_t copy = MIN(size, remaining);
+	memcpy(data->cache + data->buffer_pos, buffer, copy);
+	data->buffer_pos += copy;
+
+	/* returning short aborts the transfer once we have what we asked for */
+	return (copy < size) ? 0 : total;
+}
+
+static CURL *fetch_get_curl(void) {
+	CURL *curl = g_private_get(&fetch_curl);
+	if (curl == NULL) {
+		curl = curl_easy_init();
+		g_private_set(&fetch_curl, curl);
+	}
+	return curl;
+}
+
+/* clamp the job to the file; false if there is nothing to fetch, or no
+ * time left to fetch it in, in which case the job is marked cancelled */
+static bool fetch_job_begin(FCURL_DATA *data) {
+	data->buffer_pos = 0;
+	data->attempt = 0;
+	data->started = g_get_monotonic_time();
+
+	/* a job may wait in the queue past its deadline */
+	if (data->deadline && data->started >= data->deadline) {
+		g_atomic_int_set(&data->cancelled, 1);
+	}
+	if (g_atomic_int_get(&data->cancelled)) {
+		return false;
+	}
+
+	if ((size_t)data->pos >= (size_t)data->size) {
+		data->want = 0;
+		return false;
+	}
+	if ((data->pos+data->want) > data->size) {
+		data->want = data->size - data->pos;
+	}
+	return true;
+}
+
+/* prepare curl for one attempt at the job's range */
+static void fetch_job_setup(CURL *curl, FCURL_DATA *data) {
+	data->buffer_pos = 0;
+	data->curl = curl;
+	data->checked = false;
+
+	curl_easy_reset(curl);
+	conn_pool_setup(curl);
+	curl_easy_setopt(curl, CURLOPT_URL, data->url);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, CURL_VERBOSE);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
+			fetch_write_callback);
+	/* an error page is not data; fail the attempt and retry */
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, fetch_progress_callback);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, data);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	fetch_set_timeouts(curl, data->deadline);
+	set_range(curl, data->pos, data->pos + data->want - 1);
+}
+
+/* report the job to its requester */
+static void fetch_job_done(FCURL_DATA *data) {
+	/* nothing at all for an in-range job is a failed fetch, as is
+	 * whatever a cancelled job had */
+	bool cancelled = g_atomic_int_get(&data->cancelled);
+	bool complete = data->buffer_pos == data->want && !cancelled;
+	bool good = (data->buffer_pos || !data->want) && !cancelled;
+	if (complete && data->want) {
+		hedge_record(g_get_monotonic_time() - data->started);
+	}
+	/* ensure only available data is considered */
+	data->want = data->buffer_pos;
+
+	struct urlio_fetch_request *request = data->request;
+
+	/* the requester may free request as soon as we unlock */
+	g_mutex_lock(&request->lock);
+	data->done = true;
+	data->good = good;
+	data->complete = complete;
+	/* the other copy of a hedged job is no longer needed */
+	if (complete && data->twin) {
+		g_atomic_int_set(&data->twin->cancelled, 1);
+	}
+	if (--request->pending == 0) {
+		g_cond_signal(&request->cond);
+	}
+	g_mutex_unlock(&request->lock);
+}
+
+static void fetch_worker(gpointer job, gpointer user_data G_GNUC_UNUSED) {
+	FCURL_DATA *data = (FCURL_DATA *) job;
+
+#ifdef URLIO_VERBOSE
+	printf("worker fetching %ld byte(s) from position %ld for job %d...\n", data->want, data->pos, data->tid);
+#endif
+
+	char *host;
+	if (fetch_job_begin(data) &&
+			(host = conn_pool_acquire(data->url, data->deadline,
+			&data->cancelled)) != NULL) {
+		CURL *curl = fetch_get_curl();
+
+		for (; data->attempt < RETRY_TIMES; data->attempt++) {
+			fetch_job_setup(curl, data);
+
+			/* a write error just means we stopped at want */
+			fetch_job_result(data, curl, curl_easy_perform(curl));
+
+			if (data->buffer_pos == data->want) {
+				if (data->want && tune_record(data->url, curl, data->want)) {
+					conn_pool_wake();
+				}
+				break;
+			}
+			if (!fetch_backoff(data)) {
+				break;
+			}
+#ifdef URLIO_VERBOSE
+			printf("job %d retry %d time(s)...\n", data->tid, data->attempt+1);
+#endif
+		}
+
+		conn_pool_release(host);
+	}
+
+	fetch_job_done(data);
+}
+
+static void fetch_pool_init(void) {
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		fetch_pool = g_thread_pool_new(fetch_worker, NULL, URLIO_WORKER_NUM,
+				TRUE, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+/* HTTP/2 multiplexing
+ *
+ * Optionally, every range request is instead sent as a stream on a single
+ * HTTP/2 connection per host, all driven by one multi handle on one thread.
+ * This gives per-block parallelism without opening THREAD_NUM connections,
+ * which matters behind TLS-terminating proxies.  Servers that only speak
+ * HTTP/1.1 still work, one request per connection.
+ */
+static struct {
+	GMutex lock;
+	bool enabled;
+	long http_version;
+
+	GAsyncQueue *queue; /* jobs waiting to be added to multi */
+	CURLM *multi;
+	GThread *thread;
+} mux;
+
+static void mux_start(FCURL_DATA *data) {
+	CURL *curl = curl_easy_init();
+	fetch_job_setup(curl, data);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, data);
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, mux.http_version);
+	/* wait for the shared connection rather than opening another */
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	curl_multi_add_handle(mux.multi, curl);
+}
+
+static gpointer mux_thread(gpointer arg G_GNUC_UNUSED) {
+	GSList *delayed = NULL; /* jobs backing off before a retry */
+
+	for (;;) {
+		FCURL_DATA *data;
+		while ((data = g_async_queue_try_pop(mux.queue)) != NULL) {
+			mux_start(data);
+		}
+
+		/* restart retries that are due, and see when the next one is */
+		gint64 now = g_get_monotonic_time();
+		gint64 wait = 1000;
+		for (GSList *l = delayed, *next; l; l = next) {
+			next = l->next;
+			data = l->data;
+			if (data->retry_at <= now) {
+				delayed = g_slist_delete_link(delayed, l);
+				if (g_atomic_int_get(&data->cancelled)) {
+					fetch_job_done(data);
+				} else {
+					mux_start(data);
+				}
+			} else {
+				wait = MIN(wait, (data->retry_at - now + 999) / 1000);
+			}
+		}
+
+		int running;
+		curl_multi_perform(mux.multi, &running);
+
+		CURLMsg *msg;
+		int left;
+		while ((msg = curl_multi_info_read(mux.multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
 
-					file->fcurl_data[t] = NULL;
+			CURL *curl = msg->easy_handle;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &data);
+			fetch_job_result(data, curl, msg->data.result);
+			if (data->want && data->buffer_pos == data->want) {
+				tune_record(data->url, curl, data->want);
+			}
+			curl_multi_remove_handle(mux.multi, curl);
+			curl_easy_cleanup(curl);
+
+			if (data->buffer_pos < data->want) {
+				data->retry_at = g_get_monotonic_time() +
+						fetch_backoff_delay(data->attempt);
+				if (fetch_should_retry(data, data->retry_at)) {
+					data->attempt++;
+#ifdef URLIO_VERBOSE
+					printf("job %d retry %d time(s)...\n", data->tid, data->attempt);
+#endif
+					delayed = g_slist_prepend(delayed, data);
+					wait = 0;
+					continue;
 				}
+			}
+
+			fetch_job_done(data);
+		}
+
+		/* woken early by curl_multi_wakeup() when a job is queued */
+		int numfds;
+		curl_multi_poll(mux.multi, NULL, 0, wait, &numfds);
+	}
+
+	return NULL;
+}
+
+static void mux_init(void) {
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		const char *env = g_getenv(URLIO_HTTP2_ENV_VAR);
+		if (env && !strcmp(env, "prior-knowledge")) {
+			mux.http_version = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+		}
+		if (env && strcmp(env, "0")) {
+			urlio_set_http2_multiplex(true);
+		}
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+void urlio_set_http2_multiplex(bool enabled) {
+	g_mutex_lock(&mux.lock);
+	if (enabled && mux.thread == NULL) {
+		conn_pool_init();
+		if (!mux.http_version)
+			mux.http_version = CURL_HTTP_VERSION_2TLS;
+		mux.queue = g_async_queue_new();
+		mux.multi = curl_multi_init();
+		curl_multi_setopt(mux.multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+		curl_multi_setopt(mux.multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+		mux.thread = g_thread_new("urlio-h2", mux_thread, NULL);
+	}
+	mux.enabled = enabled;
+	g_mutex_unlock(&mux.lock);
+}
+
+bool urlio_get_http2_multiplex(void) {
+	g_mutex_lock(&mux.lock);
+	bool enabled = mux.enabled;
+	g_mutex_unlock(&mux.lock);
+	return enabled;
+}
 
-				/* if still_running is 0 now, we should return NULL */
+/* hand a job to whichever fetch engine is active */
+static void fetch_submit(FCURL_DATA *data) {
+	if (urlio_get_http2_multiplex()) {
+		if (!fetch_job_begin(data)) {
+			fetch_job_done(data);
+			return;
+		}
+		g_async_queue_push(mux.queue, data);
+		curl_multi_wakeup(mux.multi);
+	} else {
+		g_thread_pool_push(fetch_pool, data, NULL);
+	}
+}
+
+/* Run count prepared jobs in parallel and wait for all of them; false if
+ * any came back empty.  Honours the calling thread's deadline, and hedges
+ * slow jobs if enabled. */
+static bool fetch_jobs(FCURL_DATA *jobs, int count) {
+	struct urlio_fetch_request request;
+	g_mutex_init(&request.lock);
+	g_cond_init(&request.cond);
+	request.pending = count;
+
+	gint64 deadline = fetch_get_deadline();
+	gint64 hedge_at = 0;
+	gint64 delay = hedge_delay();
+	if (delay) {
+		hedge_at = g_get_monotonic_time() + delay;
+	}
 
-				/* make sure the easy handle is not in the multi handle anymore */
-				curl_multi_remove_handle(file->multi_handle, file->handle.curl);
+	size_t *wants = g_new(size_t, count);
+	for (int i = 0; i < count; i++) {
+		wants[i] = jobs[i].want;
+		jobs[i].request = &request;
+		jobs[i].deadline = deadline;
+		fetch_submit(&jobs[i]);
+	}
 
-				/* cleanup */
-				curl_easy_cleanup(file->handle.curl);
+	FCURL_DATA *hedges = NULL;
+	bool expired = false;
+	g_mutex_lock(&request.lock);
+	while (request.pending > 0) {
+		gint64 wake = expired ? 0 : deadline;
+		if (hedge_at && hedges == NULL && !expired) {
+			wake = wake ? MIN(wake, hedge_at) : hedge_at;
+		}
+		if (wake == 0) {
+			g_cond_wait(&request.cond, &request.lock);
+			continue;
+		}
+		if (g_cond_wait_until(&request.cond, &request.lock, wake)) {
+			continue;
+		}
 
-				free(file->buffer);/* free any allocated buffer space */
-				free(file->url);
-				if (file->cache_count != 0) {
-					for (int i = 0; i < file->cache_count; i++)
-						free(file->cache_list[i]);
-					free(file->cache_list);
-					free(file->cache_id_list);
+		gint64 now = g_get_monotonic_time();
+		if (deadline && now >= deadline && !expired) {
+			/* out of time; wait only for the transfers to abort */
+			expired = true;
+			for (int i = 0; i < count; i++) {
+				g_atomic_int_set(&jobs[i].cancelled, 1);
+				if (jobs[i].twin) {
+					g_atomic_int_set(&jobs[i].twin->cancelled, 1);
 				}
-				free(file);
+			}
+		} else if (!expired && hedges == NULL && hedge_at && now >= hedge_at) {
+			/* race a second copy of every job still running */
+			hedges = g_new0(FCURL_DATA, count);
+			for (int i = 0; i < count; i++) {
+				if (jobs[i].done) {
+					continue;
+				}
+				hedges[i].tid = jobs[i].tid;
+				hedges[i].url = jobs[i].url;
+				hedges[i].size = jobs[i].size;
+				hedges[i].pos = jobs[i].pos;
+				hedges[i].want = wants[i];
+				hedges[i].cache = (char*) malloc(wants[i] * sizeof(char));
+				hedges[i].request = &request;
+				hedges[i].deadline = deadline;
+				hedges[i].twin = &jobs[i];
+				jobs[i].twin = &hedges[i];
+				request.pending++;
+			}
 
-				file = NULL;
-				errno = EBADF;
+			g_mutex_unlock(&request.lock);
+			for (int i = 0; i < count; i++) {
+				if (hedges[i].cache) {
+#ifdef URLIO_VERBOSE
+					printf("hedging job %d at position %ld\n", hedges[i].tid, hedges[i].pos);
+#endif
+					fetch_submit(&hedges[i]);
+				}
 			}
+			g_mutex_lock(&request.lock);
+		}
+	}
+	g_mutex_unlock(&request.lock);
+
+	g_mutex_clear(&request.lock);
+	g_cond_clear(&request.cond);
+
+	/* take whichever copy did better */
+	bool ok = true;
+	for (int i = 0; i < count; i++) {
+		FCURL_DATA *twin = jobs[i].twin;
+		if (twin && ((twin->complete && !jobs[i].complete) ||
+				(twin->good && !jobs[i].good))) {
+			memcpy(jobs[i].cache, twin->cache, twin->want);
+			jobs[i].want = twin->want;
+			jobs[i].good = twin->good;
+		}
+		if (twin) {
+			free(twin->cache);
+			jobs[i].twin = NULL;
+		}
+		if (!jobs[i].good) {
+			ok = false;
+		}
+	}
+	g_free(hedges);
+	g_free(wants);
+
+	return ok;
+}
+
+/* bring block block_id in from the disk cache or the network */
+static struct urlio_block *urlio_fetch_block(URLIO_FILE *file, int64_t block_id) {
+	size_t disk_len;
+	char *disk_data = disk_cache_get(file, block_id, &disk_len);
+	if (disk_data) {
+		return block_cache_put(file, block_id, disk_data, disk_len);
+	}
+
+	char *host = conn_pool_host(file->url);
+	int slices = tune_slices(host);
+	size_t slice_size = CACHE_SIZE / slices;
+	g_free(host);
+
+#ifdef URLIO_VERBOSE
+	printf("block %" PRId64 " of %s cache miss, start %d job(s) downloading\n", block_id, file->url, slices);
+#endif
+
+	long int cache_id = block_id * CACHE_SIZE;
+	char *thread_cache = (char*) malloc(CACHE_SIZE * sizeof(char));
+	size_t thread_want = 0;
+
+	/* each slice lands directly in its place in the block; the last one
+	 * also takes what's left when slices doesn't divide CACHE_SIZE */
+	FCURL_DATA jobs[URLIO_MAX_SLICES];
+	for(int t = 0; t < slices; t ++) {
+		memset(&jobs[t], 0, sizeof(FCURL_DATA));
+		jobs[t].tid = t;
+		jobs[t].url = file->url;
+		jobs[t].size = file->size;
+		jobs[t].pos = cache_id+t*slice_size;
+		jobs[t].want = (t == slices - 1) ?
+				CACHE_SIZE - (slices - 1) * slice_size : slice_size;
+		jobs[t].cache = thread_cache+t*slice_size;
+	}
+
+	if (!fetch_jobs(jobs, slices)) {
+		free(thread_cache);
+		return NULL;
+	}
+
+	/* close gaps left by short slices at end of file */
+	for(int t = 0; t < slices; t ++) {
+		memmove(thread_cache+thread_want, jobs[t].cache, jobs[t].want * sizeof(char));
+		thread_want += jobs[t].want;
+	}
+
+	disk_cache_put(file, block_id, thread_cache, thread_want);
+
+	/* add block into the shared cache */
+	return block_cache_put(file, block_id, thread_cache, thread_want);
+}
+
+/* return a new reference to block block_id of file, downloading it on a
+ * miss, or NULL if the download failed */
+static struct urlio_block *urlio_get_block(URLIO_FILE *file, int64_t block_id) {
+	struct urlio_block *block = block_cache_get(file, block_id);
+	if (block) {
+		return block;
+	}
+
+	/* share the download with anyone else missing the same block */
+	struct urlio_inflight *flight = inflight_begin(file, block_id, &block);
+	if (flight == NULL) {
+		return block;
+	}
+	block = urlio_fetch_block(file, block_id);
+	inflight_end(flight, block);
+	return block;
+}
+
+/* cached copy of exactly [offset, offset + len), or NULL */
+static struct urlio_block *range_cache_get(URLIO_FILE *file, int64_t offset,
+		size_t len) {
+	struct urlio_block *block = block_cache_get(file, RANGE_ID(offset));
+	if (block == NULL && len <= CACHE_SIZE) {
+		size_t disk_len;
+		char *disk_data = disk_cache_get(file, RANGE_ID(offset), &disk_len);
+		if (disk_data) {
+			block = block_cache_put(file, RANGE_ID(offset), disk_data, disk_len);
+		}
+	}
+
+	/* an entry stored for a shorter range at the same offset won't do */
+	if (block && block->len < len) {
+		urlio_block_unref(block);
+		block = NULL;
+	}
+	return block;
+}
+
+static struct urlio_block *range_cache_put(URLIO_FILE *file, int64_t offset,
+		char *data, size_t len) {
+	if (len <= CACHE_SIZE) {
+		disk_cache_put(file, RANGE_ID(offset), data, len);
+	}
+	return block_cache_put(file, RANGE_ID(offset), data, len);
+}
+
+/* A cached range of any start that covers [offset, offset + len), so reads
+ * that don't line up with a fetched range, such as libtiff walking a
+ * directory that the tifflike parser already pulled in, don't fetch it
+ * again.  Returns a new reference and sets *skip to offset's position in
+ * it, or NULL. */
+static struct urlio_block *range_cache_find(const URLIO_FILE *file,
+		int64_t offset, size_t len, size_t *skip) {
+	struct urlio_block_key probe = { .file = file, .id = RANGE_ID(offset) };
+	struct urlio_block *block = NULL;
+
+	block_cache_init();
+	g_mutex_lock(&block_cache.lock);
+	GSequenceIter *iter = g_sequence_search(block_cache.ranges, &probe,
+			range_key_cmp, NULL);
+	for (int i = 0; i < RANGE_LOOKBACK && !g_sequence_iter_is_begin(iter); i++) {
+		iter = g_sequence_iter_prev(iter);
+		struct urlio_block_key *key = g_sequence_get(iter);
+		if (key->file != file)
+			break;
+
+		struct urlio_block_value *value =
+				g_hash_table_lookup(block_cache.hashtable, key);
+		int64_t start = -1 - key->id;
+		if (offset + (int64_t) len <= start + (int64_t) value->block->len) {
+			block = block_cache_lookup(key);
+			*skip = offset - start;
+			break;
 		}
+	}
+	g_mutex_unlock(&block_cache.lock);
+	return block;
+}
+
+/* file index
+ *
+ * A caller that parses a remote file may keep what it learned alongside
+ * the file's blocks, under an id below every RANGE_ID, so that reopening
+ * the file skips the parse.  The index lives in the block cache while the
+ * handle is registered, and in the disk cache, keyed like the blocks by
+ * URL, validator and size, across processes.  Off unless
+ * URLIO_INDEX_ENV_VAR or urlio_set_indexing() turns it on.
+ */
+static gint index_enabled; /* atomic */
+
+static void index_init(void) {
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		const char *env = g_getenv(URLIO_INDEX_ENV_VAR);
+		if (env && strcmp(env, "0")) {
+			urlio_set_indexing(true);
+		}
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+bool urlio_get_indexing(void) {
+	return g_atomic_int_get(&index_enabled);
+}
+
+void urlio_set_indexing(bool enabled) {
+	g_atomic_int_set(&index_enabled, enabled);
+}
+
+/* whether file is read over the network rather than from local disk */
+bool urlio_fremote(URLIO_FILE *file) {
+	return file->type == CFTYPE_CURL;
+}
+
+/* whether file can keep an index: it is remote and indexing is on */
+bool urlio_findexable(URLIO_FILE *file) {
+	return urlio_fremote(file) && urlio_get_indexing();
+}
+
+/* Borrow the index kept for file, if there is one; 0 if not.  *block is
+ * released with urlio_block_unref(). */
+size_t urlio_fget_index(URLIO_FILE *file, const char **data,
+		struct urlio_block **block) {
+	*data = NULL;
+	*block = NULL;
+	if (!urlio_findexable(file))
+		return 0;
+
+	struct urlio_block *b = block_cache_get(file, INDEX_ID);
+	if (b == NULL) {
+		size_t len;
+		char *disk_data = disk_cache_get(file, INDEX_ID, &len);
+		if (disk_data == NULL)
+			return 0;
+		b = block_cache_put(file, INDEX_ID, disk_data, len);
+	}
+	*data = b->data;
+	*block = b;
+	return b->len;
+}
+
+/* keep a copy of data as file's index, replacing any before it */
+void urlio_fput_index(URLIO_FILE *file, const void *data, size_t len) {
+	if (!urlio_findexable(file) || len == 0)
+		return;
+
+	char *copy = (char*) malloc(len * sizeof(char));
+	memcpy(copy, data, len);
+	disk_cache_put(file, INDEX_ID, copy, len);
+	urlio_block_unref(block_cache_put(file, INDEX_ID, copy, len));
+}
+
+/* one coalesced request of a range fetch, covering ranges [first, last) */
+struct range_span {
+	int64_t start;
+	int64_t end;
+	int first;
+	int last;
+};
+
+/* multipart/byteranges
+ *
+ * Several spans can be asked for in one request, "Range: bytes=a-b,c-d".
+ * A server that supports it answers 206 with one part per range, each with
+ * its own Content-Range; one that merges them may answer a single 206
+ * instead.  Either way the bytes are scattered straight into the spans'
+ * buffers.  A 200 means multiple ranges aren't supported: the transfer is
+ * abandoned at once and the handle stops trying.
+ */
+enum multipart_phase {
+	MULTIPART_PREAMBLE, /* looking for a boundary line */
+	MULTIPART_HEADERS,
+	MULTIPART_BODY,
+	MULTIPART_END,
+};
+
+struct multipart_state {
+	CURL *curl;
+	FCURL_DATA *jobs; /* spans, each a job with its own buffer */
+	int count;
+
+	bool checked; /* response code inspected */
+	long code;
+	bool multipart; /* body is multipart rather than one 206 range */
+	char *boundary; /* delimiter line, including the leading "--" */
+	int64_t single_start; /* Content-Range start of a single 206 */
+
+	enum multipart_phase phase;
+	GString *line; /* partial preamble or header line */
+	int64_t part_pos; /* file offset of the next body byte */
+	int64_t part_end;
+};
+
+/* copy body bytes at file offset pos into every span they overlap */
+static void multipart_scatter(struct multipart_state *state, int64_t pos,
+		const char *buffer, size_t len) {
+	for (int i = 0; i < state->count; i++) {
+		FCURL_DATA *job = &state->jobs[i];
+		int64_t start = MAX(pos, job->pos);
+		int64_t end = MIN(pos + (int64_t) len, job->pos + (int64_t) job->want);
+		/* only extend what the job already has contiguously */
+		if (start >= end || start > job->pos + (int64_t) job->buffer_pos)
+			continue;
+		memcpy(job->cache + (start - job->pos), buffer + (start - pos),
+				end - start);
+		job->buffer_pos = MAX(job->buffer_pos, (size_t) (end - job->pos));
+	}
+}
+
+/* one complete preamble or part header line, without its line ending */
+static bool multipart_line(struct multipart_state *state, const char *line) {
+	size_t len = strlen(line);
+
+	if (state->phase == MULTIPART_PREAMBLE) {
+		size_t blen = strlen(state->boundary);
+		if (!strncmp(line, state->boundary, blen)) {
+			state->phase = strncmp(line + blen, "--", 2) ?
+					MULTIPART_HEADERS : MULTIPART_END;
+			state->part_pos = state->part_end = -1;
+		}
+		return true;
+	}
+
+	if (len == 0) {
+		/* end of part headers; every part must say where it goes */
+		if (state->part_pos < 0)
+			return false;
+		state->phase = MULTIPART_BODY;
+		return true;
+	}
+
+	char *value = header_value(line, len, "content-range");
+	if (value) {
+		long long first, last;
+		if (sscanf(value, "bytes %lld-%lld", &first, &last) == 2 &&
+				first <= last) {
+			state->part_pos = first;
+			state->part_end = last + 1;
+		}
+		g_free(value);
+	}
+	return true;
+}
+
+static size_t multipart_header_callback(char *buffer, size_t size,
+		size_t nitems, void *userp) {
+	struct multipart_state *state = userp;
+	size *= nitems;
+	char *value;
+
+	if ((value = header_value(buffer, size, "content-type")) != NULL) {
+		/* multipart/byteranges; boundary=THIS_STRING_SEPARATES */
+		char *param = strstr(value, "boundary=");
+		if (param && !g_ascii_strncasecmp(value, "multipart/byteranges", 20)) {
+			char *b = param + strlen("boundary=");
+			if (*b == '"') {
+				b++;
+				b[strcspn(b, "\"")] = 0;
+			} else {
+				b[strcspn(b, "; \t")] = 0;
+			}
+			g_free(state->boundary);
+			state->boundary = g_strconcat("--", b, NULL);
+		}
+		g_free(value);
+	} else if ((value = header_value(buffer, size, "content-range")) != NULL) {
+		long long first, last;
+		if (sscanf(value, "bytes %lld-%lld", &first, &last) == 2) {
+			state->single_start = first;
+		}
+		g_free(value);
+	}
+
+	return size;
+}
+
+static size_t multipart_write_callback(char *buffer, size_t size,
+		size_t nitems, void *userp) {
+	struct multipart_state *state = userp;
+	size *= nitems;
+	size_t total = size;
+
+	if (!state->checked) {
+		curl_easy_getinfo(state->curl, CURLINFO_RESPONSE_CODE, &state->code);
+		state->checked = true;
+		if (state->code != 206)
+			return 0; /* the whole file is coming; don't wait for it */
+		state->multipart = state->boundary != NULL;
+		if (!state->multipart) {
+			if (state->single_start < 0)
+				return 0;
+			state->phase = MULTIPART_BODY;
+			state->part_pos = state->single_start;
+			state->part_end = G_MAXINT64;
+		}
+	}
+
+	while (size > 0) {
+		if (state->phase == MULTIPART_END) {
+			return total; /* epilogue */
+		}
+
+		if (state->phase == MULTIPART_BODY) {
+			size_t n = MIN(size, (size_t) (state->part_end - state->part_pos));
+			multipart_scatter(state, state->part_pos, buffer, n);
+			state->part_pos += n;
+			buffer += n;
+			size -= n;
+			if (state->part_pos == state->part_end) {
+				state->phase = MULTIPART_PREAMBLE;
+			}
+			continue;
+		}
+
+		/* preamble and part headers are CRLF terminated lines */
+		char *eol = memchr(buffer, '\n', size);
+		size_t n = eol ? (size_t) (eol - buffer) + 1 : size;
+		g_string_append_len(state->line, buffer, n);
+		buffer += n;
+		size -= n;
+		if (state->line->len > 4096)
+			return 0;
+		if (eol) {
+			g_strchomp(state->line->str);
+			bool ok = multipart_line(state, state->line->str);
+			g_string_truncate(state->line, 0);
+			if (!ok)
+				return 0;
+		}
+	}
+
+	return total;
+}
+
+/* Fetch as many of the jobs as possible with multi-range requests.  Jobs
+ * are left with buffer_pos short of want if they still need fetching. */
+static void multipart_fetch(URLIO_FILE *file, FCURL_DATA *jobs, int count) {
+	CURL *curl = fetch_get_curl();
+	char *host = conn_pool_acquire(file->url, fetch_get_deadline(), NULL);
+	if (host == NULL)
+		return;
+
+	for (int first = 0; first < count &&
+			g_atomic_int_get(&file->multipart) >= 0;
+			first += URLIO_MULTIPART_RANGES) {
+		int n = MIN(count - first, URLIO_MULTIPART_RANGES);
+		GString *ranges = g_string_new(NULL);
+		for (int i = first; i < first + n; i++) {
+			if (!fetch_job_begin(&jobs[i]))
+				continue;
+			g_string_append_printf(ranges, "%s%ld-%ld", ranges->len ? "," : "",
+					jobs[i].pos, jobs[i].pos + (long int) jobs[i].want - 1);
+		}
+		if (ranges->len == 0) {
+			g_string_free(ranges, TRUE);
+			continue;
+		}
+
+		struct multipart_state state = {
+			.curl = curl,
+			.jobs = jobs + first,
+			.count = n,
+			.single_start = -1,
+			.line = g_string_new(NULL),
+		};
+
+		curl_easy_reset(curl);
+		conn_pool_setup(curl);
+		curl_easy_setopt(curl, CURLOPT_URL, file->url);
+		curl_easy_setopt(curl, CURLOPT_VERBOSE, CURL_VERBOSE);
+		curl_easy_setopt(curl, CURLOPT_RANGE, ranges->str);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, multipart_header_callback);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &state);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, multipart_write_callback);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &state);
+		fetch_set_timeouts(curl, fetch_get_deadline());
+		curl_easy_perform(curl);
+
+		if (state.code == 200) {
+			/* the server won't serve multiple ranges */
+			g_atomic_int_set(&file->multipart, -1);
+		} else if (state.multipart) {
+			g_atomic_int_set(&file->multipart, 1);
+		}
+
+#ifdef URLIO_VERBOSE
+		printf("multipart: %d range(s) of %s in one request, %s\n", n,
+				file->url, state.multipart ? "multipart" :
+				state.checked && state.single_start >= 0 ? "merged" : "refused");
+#endif
+
+		g_string_free(state.line, TRUE);
+		g_free(state.boundary);
+		g_string_free(ranges, TRUE);
+	}
+
+	conn_pool_release(host);
+}
+
+static int range_offset_cmp(gconstpointer a, gconstpointer b, gpointer offsets) {
+	int64_t oa = ((const int64_t *) offsets)[*(const int *) a];
+	int64_t ob = ((const int64_t *) offsets)[*(const int *) b];
+	return (oa > ob) - (oa < ob);
+}
+
+/* Fetch count ranges with as few requests as possible, and cache each one
+ * as its own entry.  Ranges closer than URLIO_RANGE_GAP bytes share a
+ * request, up to CACHE_SIZE bytes per request; all requests run in
+ * parallel.  On success the new blocks are stored in out, if given. */
+static bool range_fetch(URLIO_FILE *file, int count, const int64_t *offsets,
+		const int64_t *lengths, struct urlio_block **out) {
+	if (count == 0)
+		return true;
+
+	int *order = g_new(int, count);
+	for (int i = 0; i < count; i++)
+		order[i] = i;
+	g_qsort_with_data(order, count, sizeof(int), range_offset_cmp,
+			(gpointer) offsets);
+
+	GArray *spans = g_array_new(FALSE, FALSE, sizeof(struct range_span));
+	for (int i = 0; i < count; i++) {
+		int64_t start = offsets[order[i]];
+		int64_t end = start + lengths[order[i]];
+		struct range_span *span = spans->len ?
+				&g_array_index(spans, struct range_span, spans->len - 1) : NULL;
+		if (span && start <= span->end + URLIO_RANGE_GAP &&
+				MAX(end, span->end) - span->start <= CACHE_SIZE) {
+			span->end = MAX(end, span->end);
+			span->last = i + 1;
+		} else {
+			struct range_span next = { start, end, i, i + 1 };
+			g_array_append_val(spans, next);
+		}
+	}
+
+#ifdef URLIO_VERBOSE
+	printf("range fetch: %d range(s) of %s in %u request(s)\n", count, file->url, spans->len);
+#endif
+
+	FCURL_DATA *jobs = g_new0(FCURL_DATA, spans->len);
+	for (guint j = 0; j < spans->len; j++) {
+		struct range_span *span = &g_array_index(spans, struct range_span, j);
+		jobs[j].tid = j;
+		jobs[j].url = file->url;
+		jobs[j].size = file->size;
+		jobs[j].pos = span->start;
+		jobs[j].want = span->end - span->start;
+		jobs[j].cache = (char*) malloc(jobs[j].want * sizeof(char));
+	}
+
+	/* one round trip for all of the spans if the server allows, then
+	 * parallel single-range requests for whatever is still missing */
+	if (spans->len > 1 && g_atomic_int_get(&file->multipart) >= 0) {
+		multipart_fetch(file, jobs, spans->len);
+	}
+	FCURL_DATA *retry = g_new0(FCURL_DATA, spans->len);
+	int retries = 0;
+	for (guint j = 0; j < spans->len; j++) {
+		if (spans->len == 1 || jobs[j].buffer_pos < jobs[j].want) {
+			retry[retries++] = jobs[j];
+		}
+	}
+	bool ok = fetch_jobs(retry, retries);
+	for (int r = 0, j = 0; r < retries; r++) {
+		while (jobs[j].cache != retry[r].cache)
+			j++;
+		jobs[j].want = retry[r].want;
+	}
+	g_free(retry);
+
+	/* a span came back short only at end of file */
+	for (guint j = 0; j < spans->len; j++) {
+		struct range_span *span = &g_array_index(spans, struct range_span, j);
+		for (int i = span->first; ok && i < span->last; i++) {
+			int64_t offset = offsets[order[i]];
+			int64_t skip = offset - span->start;
+			size_t len = CLAMP((int64_t) jobs[j].want - skip, 0, lengths[order[i]]);
+			char *data = (char*) malloc(MAX(len, 1) * sizeof(char));
+			memcpy(data, jobs[j].cache + skip, len);
+			struct urlio_block *block = range_cache_put(file, offset, data, len);
+			if (out) {
+				out[order[i]] = block;
+			} else {
+				urlio_block_unref(block);
+			}
+		}
+		free(jobs[j].cache);
+	}
+
+	g_free(jobs);
+	g_array_free(spans, TRUE);
+	g_free(order);
+	return ok;
+}
+
+/* URL registry
+ *
+ * Remote handles are shared by everyone who opens the same URL and are
+ * found through a hash table keyed by URL.  Each handle counts its opens.
+ * After the last close it stays registered, blocks and all, so reopening
+ * is free, until urlio_frelease() or until the reaper thread finds it idle
+ * for longer than the TTL.
+ */
+static struct {
+	GMutex lock;
+	GCond cond; /* wakes the reaper early when the TTL changes */
+	GHashTable *files; /* url -> URLIO_FILE; keys are the handles' url */
+	unsigned ttl; /* seconds; 0 keeps idle handles until released */
+} url_registry;
+
+static void urlio_file_free(URLIO_FILE *file) {
+	curl_easy_cleanup(file->handle.curl);
+	free(file->url);
+	g_free(file->etag);
+	g_free(file->last_modified);
+	g_free(file->disk_key);
+	block_cache_purge(file);
+	free(file);
+}
+
+static gpointer url_registry_reaper(gpointer data G_GNUC_UNUSED) {
+	g_mutex_lock(&url_registry.lock);
+	for (;;) {
+		/* look a few times per TTL, so handles live at most ~1.5 TTLs */
+		gint64 interval = MAX(url_registry.ttl, 2) * G_USEC_PER_SEC / 2;
+		g_cond_wait_until(&url_registry.cond, &url_registry.lock,
+				g_get_monotonic_time() + interval);
+		if (url_registry.ttl == 0) {
+			continue;
+		}
+
+		gint64 now = g_get_monotonic_time();
+		gint64 ttl = (gint64) url_registry.ttl * G_USEC_PER_SEC;
+		GSList *idle = NULL;
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, url_registry.files);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			URLIO_FILE *file = value;
+			if (file->refcount == 0 && now - file->idle_since >= ttl) {
+				g_hash_table_iter_remove(&iter);
+				idle = g_slist_prepend(idle, file);
+			}
+		}
+
+		/* curl and block cache cleanup don't need the registry */
+		g_mutex_unlock(&url_registry.lock);
+		for (GSList *l = idle; l; l = l->next) {
+#ifdef URLIO_VERBOSE
+			printf("reaper: dropping idle %s\n", ((URLIO_FILE *) l->data)->url);
+#endif
+			urlio_file_free(l->data);
+		}
+		g_slist_free(idle);
+		g_mutex_lock(&url_registry.lock);
+	}
+
+	return NULL;
+}
+
+static void url_registry_init(void) {
+	static gsize initialized;
+
+	if (g_once_init_enter(&initialized)) {
+		url_registry.files = g_hash_table_new(g_str_hash, g_str_equal);
+		url_registry.ttl = URLIO_IDLE_TTL;
+
+		const char *env = g_getenv(URLIO_IDLE_TTL_ENV_VAR);
+		if (env) {
+			char *endptr;
+			guint64 ttl = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0] && ttl <= G_MAXUINT) {
+				url_registry.ttl = ttl;
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_IDLE_TTL_ENV_VAR, env);
+			}
+		}
+
+		g_thread_new("urlio-reaper", url_registry_reaper, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
+/* take another reference to a registered handle; call with the lock held */
+static void url_registry_reuse(URLIO_FILE *file) {
+	file->refcount++;
+	file->release_flag = false;
+	file->close_flag = false;
+
+	/* no network activity until the first read */
+	file->pos = 0;
+	file->eof_flag = false;
+	file->error_flag = false;
+}
+
+unsigned urlio_get_idle_ttl(void) {
+	url_registry_init();
+
+	g_mutex_lock(&url_registry.lock);
+	unsigned ttl = url_registry.ttl;
+	g_mutex_unlock(&url_registry.lock);
+	return ttl;
+}
+
+void urlio_set_idle_ttl(unsigned seconds) {
+	url_registry_init();
+
+	g_mutex_lock(&url_registry.lock);
+	url_registry.ttl = seconds;
+	g_cond_signal(&url_registry.cond);
+	g_mutex_unlock(&url_registry.lock);
+}
+
+
+/* Fetch the first block of a new remote file with a single bounded GET.
+ * The response headers give the length (Content-Range, or Content-Length
+ * when the server ignores Range) and validators, and the body seeds the
+ * block cache so the caller's first read, usually a header parse, needs no
+ * second round trip. */
+static bool urlio_probe(URLIO_FILE *file) {
+	CURL *curl = file->handle.curl;
+	FCURL_DATA job;
+	long code = 0;
+
+	memset(&job, 0, sizeof(FCURL_DATA));
+	job.url = file->url;
+	job.want = CACHE_SIZE;
+	job.deadline = fetch_get_deadline();
+
+	char *host = conn_pool_acquire(file->url, job.deadline, NULL);
+	if (host == NULL) {
+		return false;
+	}
+	char *cache = (char*) malloc(CACHE_SIZE * sizeof(char));
+	job.cache = cache;
+
+	for (; job.attempt < RETRY_TIMES; job.attempt++) {
+		file->size = 0;
+		file->accept_ranges = false;
+
+		fetch_job_setup(curl, &job);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, file);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+
+		/* a write error just means we stopped at want */
+		fetch_job_result(&job, curl, curl_easy_perform(curl));
+
+		if (job.buffer_pos || !fetch_backoff(&job)) {
+			break;
+		}
+#ifdef URLIO_VERBOSE
+		printf("fopen: probe retry %d time(s)...\n", job.attempt+1);
+#endif
+	}
+
+	conn_pool_release(host);
+
+	if (!job.buffer_pos) {
+		free(cache);
+		return false;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code == 206) {
+		file->accept_ranges = true;
+	} else if (file->size == 0) {
+		/* server ignored Range, the body is the whole file */
+		double dSize;
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &dSize);
+		if (dSize > 0)
+			file->size = (long) dSize;
+	}
+	if (file->size == 0) {
+		/* no length at all; a short body must be the whole file */
+		if (job.buffer_pos == CACHE_SIZE) {
+			free(cache);
+			return false;
+		}
+		file->size = job.buffer_pos;
+	}
+#ifdef URLIO_VERBOSE
+	printf("fopen: file length %zu%s\n", file->size,
+			file->accept_ranges ? "" : ", no range support");
+#endif
+
+	file->disk_key = disk_cache_key(file);
+
+	size_t len = MIN(job.buffer_pos, file->size);
+	disk_cache_put(file, 0, cache, len);
+	urlio_block_unref(block_cache_put(file, 0, cache, len));
+	return true;
+}
+
+URLIO_FILE *urlio_fopen(const char *url, const char *operation) {
+	/* this code could check for URLs or types in the 'url' and
+	 basically use the real fopen() for standard files */
+#ifdef URLIO_VERBOSE
+	printf("fopen: %s\n", url);
+#endif
+
+
+
+
+
+
+
+
+
+
+
+	URLIO_FILE *file;
+
+	FILE *f;
+
+
+
+
+
+
+
+	f = fopen(url, operation);
+	if (f) {
+		file = (URLIO_FILE*)malloc(sizeof(URLIO_FILE));
+
+		if (!file) {
+			errno = EBADF;
+			// g_mutex_unlock(&cache_lock);
+			return NULL;
+		}
+
+		memset(file, 0, sizeof(URLIO_FILE));
+
+		file->url = (char*) malloc((strlen(url)+1) * sizeof(char));
+		strcpy(file->url, url);
+
+		file->close_flag = false;
+		file->handle.file = f;
+		file->type = CFTYPE_FILE; /* marked as URL */
+	} else {
+		url_registry_init();
+
+		g_mutex_lock(&url_registry.lock);
+		file = g_hash_table_lookup(url_registry.files, url);
+		if (file) {
+			url_registry_reuse(file);
+		}
+		g_mutex_unlock(&url_registry.lock);
+		if (file) {
+			return file;
+		}
+
+		file = (URLIO_FILE*)malloc(sizeof(URLIO_FILE));
+
+		if (!file) {
+			errno = EBADF;
+			return NULL;
+		}
+
+		memset(file, 0, sizeof(URLIO_FILE));
+
+
+
+		file->type = CFTYPE_CURL; /* marked as URL */
+		file->handle.curl = curl_easy_init();
 
-		if (file != NULL) {
-			// initial url cache
-			if (url_cache_count == 0)
-				url_cache = (URLIO_FILE**) malloc(sizeof(URLIO_FILE*));
-			else
-				url_cache = (URLIO_FILE**) realloc(url_cache,
-						(url_cache_count + 1) * sizeof(URLIO_FILE*));
+		file->url = (char*) malloc((strlen(url)+1) * sizeof(char));
+		strcpy(file->url, url);
 
-			url_cache[url_cache_count] = file;
+		/* one request tells us the length and validators, and brings in
+		 * the first block */
+		if (!urlio_probe(file)) {
+			urlio_file_free(file);
 
-			url_cache_count++;
+			file = NULL;
+			errno = EBADF;
+		}
 
-			// g_mutex_unlock(&cache_lock);
 
-			// initial house keeping thread
+		if (file != NULL) {
+			g_mutex_lock(&url_registry.lock);
+			URLIO_FILE *existing = g_hash_table_lookup(url_registry.files, url);
+			if (existing) {
+				/* another thread opened the URL while we were probing */
+				url_registry_reuse(existing);
+			} else {
+				file->refcount = 1;
+				g_hash_table_insert(url_registry.files, file->url, file);
+			}
+			g_mutex_unlock(&url_registry.lock);
 
-			// if(ghousekeepingthread == NULL) {
-			// 	ghousekeepingthread = g_thread_new("housekeeping thread",
-			// 		&housekeepingthread, NULL);
-			// }
+			if (existing) {
+				urlio_file_free(file);
+				file = existing;
+			}
 		}
 	}
 
@@ -1112,21 +2874,27 @@ int urlio_fclose(URLIO_FILE *file) {
 
 		break;
 
-	case CFTYPE_CURL:
-		// g_mutex_lock(&cache_lock);
+	case CFTYPE_CURL: {
+		bool release = false;
 
-		// int ret = 0;/* default is good return */
+		g_mutex_lock(&url_registry.lock);
+		if (file->refcount > 0 && --file->refcount == 0) {
+			file->close_flag = true;
+			file->idle_since = g_get_monotonic_time();
 
-		for (int i = 0; i < url_cache_count; i++) {
-			if ((long int) file == (long int) url_cache[i]) {
-				file->close_flag = true;
-				break;
+			/* urlio_frelease() was waiting for us */
+			if (file->release_flag) {
+				g_hash_table_remove(url_registry.files, file->url);
+				release = true;
 			}
 		}
+		g_mutex_unlock(&url_registry.lock);
 
-		// g_mutex_unlock(&cache_lock);
-
+		if (release) {
+			urlio_file_free(file);
+		}
 		break;
+	}
 
 	default: /* unknown or supported type - oh dear */
 		ret = -1;
@@ -1143,111 +2911,41 @@ void urlio_finitial(void) {
 #endif
 
 	g_thread_init(NULL);
-	curl_global_init(CURL_GLOBAL_ALL);
+	conn_pool_init();
+	block_cache_init();
+	fetch_pool_init();
+	mux_init();
+	hedge_init();
+	tune_init();
+	disk_cache_init();
+	index_init();
+	url_registry_init();
 }
 
 int urlio_frelease(const char *url) {
 #ifdef URLIO_VERBOSE
 	printf("frelease: %s\n", url);
 #endif
-	// g_mutex_lock(&cache_lock);
-
-	int ret = -1;/* default is bad return */
-
-	for (int count = 0; count < url_cache_count; count++) {
-		if (0 == strcmp(url_cache[count]->url, url)) {
-			// url_cache[count]->cacheLifeSpan = 0;
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-			curl_multi_remove_handle(url_cache[count]->multi_handle,
-									url_cache[count]->handle.curl);
-
-			/* cleanup */
-			curl_easy_cleanup(url_cache[count]->handle.curl);
-
-			/* clean up multithread */
-			for (int t = 0; t < THREAD_NUM; t ++) {
-				/* if still_running is 0 now, we should return NULL */
-
-				/* make sure the easy handle is not in the multi handle anymore */
-				curl_multi_remove_handle(url_cache[count]->fcurl_data[t]->multi_handle, url_cache[count]->fcurl_data[t]->handle.curl);
-
-				/* cleanup */
-				curl_easy_cleanup(url_cache[count]->fcurl_data[t]->handle.curl);
-
-				free(url_cache[count]->fcurl_data[t]->buffer);/* free any allocated buffer space */
-				free(url_cache[count]->fcurl_data[t]->url);
-				free(url_cache[count]->fcurl_data[t]->cache);
-				free(url_cache[count]->fcurl_data[t]);
-
-				url_cache[count]->fcurl_data[t] = NULL;
-			}
-
-			free(url_cache[count]->buffer);/* free any allocated buffer space */
-			free(url_cache[count]->url);
-			if (url_cache[count]->cache_count != 0) {
-				for (int i = 0; i < url_cache[count]->cache_count; i++)
-					free(url_cache[count]->cache_list[i]);
-				free(url_cache[count]->cache_list);
-				free(url_cache[count]->cache_id_list);
-			}
-
-			free(url_cache[count]);
-
-			url_cache[count] = NULL;
-
-			if (count != url_cache_count - 1)
-				memmove(&url_cache[count], &url_cache[count + 1],
-						(url_cache_count - count - 1) * sizeof(URLIO_FILE*));
-			if (url_cache_count != 1) {
-				url_cache = (URLIO_FILE**) realloc(url_cache,
-						(url_cache_count - 1) * sizeof(URLIO_FILE*));
-				url_cache_count--;
-			} else {
-				free(url_cache);
-				url_cache = NULL;
-				url_cache_count = 0;
-			}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-			ret = 0;
-		}
+	url_registry_init();
+
+	g_mutex_lock(&url_registry.lock);
+	URLIO_FILE *file = g_hash_table_lookup(url_registry.files, url);
+	if (file && file->refcount > 0) {
+		/* still open elsewhere; the last urlio_fclose() frees it */
+		file->release_flag = true;
+		g_mutex_unlock(&url_registry.lock);
+		return 0;
 	}
+	if (file) {
+		g_hash_table_remove(url_registry.files, url);
+	}
+	g_mutex_unlock(&url_registry.lock);
 
-	// g_mutex_unlock(&cache_lock);
-	return ret;
+	if (file == NULL) {
+		return -1;
+	}
+	urlio_file_free(file);
+	return 0;
 }
 
 int urlio_feof(URLIO_FILE *file) {
@@ -1262,8 +2960,7 @@ int urlio_feof(URLIO_FILE *file) {
 		break;
 
 	case CFTYPE_CURL:
-		if ((file->buffer_pos == 0) && (!file->still_running))
-			ret = 1;
+		ret = file->eof_flag ? 1 : 0;
 		break;
 
 	default: /* unknown or supported type - oh dear */
@@ -1288,8 +2985,7 @@ int urlio_ferror(URLIO_FILE *file) {
 		break;
 
 	case CFTYPE_CURL:
-		if ((file->buffer_pos == 0) && (!file->still_running))
-			ret = 1;
+		ret = file->error_flag ? 1 : 0;
 		break;
 
 	default: /* unknown or supported type - oh dear */
@@ -1318,51 +3014,41 @@ char *urlio_fgets(char *ptr, size_t size, URLIO_FILE *file) {
 		printf("fgets: from position %ld read %zu byte(s)\n", file->pos, size);
 #endif
 
-		for (int retry = 0; retry < RETRY_TIMES; retry++) {
-			fill_buffer(file, want);
-			if (file->buffer_pos)
+		for (loop = 0; loop < want; ) {
+			struct urlio_block *block = urlio_get_block(file, file->pos / CACHE_SIZE);
+			if (block == NULL) {
+				file->error_flag = true;
 				break;
+			}
 
-			/* halt transaction */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* ditch buffer - write will recreate - resets stream pos*/
-			free(file->buffer);
-			file->buffer = NULL;
-			file->buffer_pos = 0;
-			file->buffer_len = 0;
-
-			/* restart */
-			curl_multi_add_handle(file->multi_handle, file->handle.curl);
-
-			/* lets start the fetch again */
-			curl_multi_perform(file->multi_handle, &file->still_running);
-		}
+			size_t offset = file->pos % CACHE_SIZE;
+			if (offset >= block->len) {
+				urlio_block_unref(block);
+				file->eof_flag = true;
+				break;
+			}
 
-		/* check if theres data in the buffer - if not fill either errored or
-		 * EOF */
-		if (!file->buffer_pos)
-			return NULL;
+			/* look for newline or end of block */
+			size_t n = MIN(want - loop, block->len - offset);
+			char *nl = memchr(block->data + offset, '\n', n);
+			if (nl)
+				n = nl - (block->data + offset) + 1; /* include newline */
 
-		/* ensure only available data is considered */
-		if (file->buffer_pos < want)
-			want = file->buffer_pos;
+			/* xfer data to caller */
+			memcpy(ptr + loop, block->data + offset, n);
+			urlio_block_unref(block);
 
-		/*buffer contains data */
-		/* look for newline or eof */
-		for (loop = 0; loop < want; loop++) {
-			if (file->buffer[loop] == '\n') {
-				want = loop + 1;/* include newline */
+			loop += n;
+			file->pos += n;
+			if (nl)
 				break;
-			}
 		}
 
-		/* xfer data to caller */
-		memcpy(ptr, file->buffer, want);
-		ptr[want] = 0;/* allways null terminate */
+		/* nothing read means error or EOF */
+		if (loop == 0)
+			return NULL;
 
-		use_buffer(file, want);
-		file->pos += want;
+		ptr[loop] = 0;/* allways null terminate */
 		break;
 
 	default: /* unknown or supported type - oh dear */
@@ -1391,37 +3077,26 @@ int urlio_fgetc(URLIO_FILE *file) {
 		printf("fgetc: from position %ld read 1 byte\n", file->pos);
 #endif
 
-		for (int retry = 0; retry < RETRY_TIMES; retry++) {
-			fill_buffer(file, 1);
-			if (file->buffer_pos)
-				break;
-
-			/* halt transaction */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* ditch buffer - write will recreate - resets stream pos*/
-			free(file->buffer);
-			file->buffer = NULL;
-			file->buffer_pos = 0;
-			file->buffer_len = 0;
+		{
+			struct urlio_block *block = urlio_get_block(file, file->pos / CACHE_SIZE);
+			if (block == NULL) {
+				file->error_flag = true;
+				return EOF;
+			}
 
-			/* restart */
-			curl_multi_add_handle(file->multi_handle, file->handle.curl);
+			size_t offset = file->pos % CACHE_SIZE;
+			if (offset >= block->len) {
+				urlio_block_unref(block);
+				file->eof_flag = true;
+				return EOF;
+			}
 
-			/* lets start the fetch again */
-			curl_multi_perform(file->multi_handle, &file->still_running);
+			/* xfer data to caller */
+			c = (unsigned char) block->data[offset];
+			urlio_block_unref(block);
+			file->pos++;
 		}
 
-		/* check if theres data in the buffer - if not fill_buffer()
-		 * either errored or EOF */
-		if (!file->buffer_pos)
-			return EOF;
-
-		/* xfer data to caller */
-		c = (int) *(file->buffer);
-		use_buffer(file, 1);
-		file->pos++;
-
 		break;
 
 	default: /* unknown or supported type - oh dear */
@@ -1450,51 +3125,9 @@ void urlio_rewind(URLIO_FILE *file) {
 		printf("rewind: from position %ld\n", file->pos);
 #endif
 
-		/* halt transaction */
-		curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-		/* ditch buffer - write will recreate - resets stream pos*/
-		free(file->buffer);
-		file->buffer = NULL;
-		file->buffer_pos = 0;
-		file->buffer_len = 0;
 		file->pos = 0;
-
-		/* reset */
-		curl_easy_reset(file->handle.curl);
-		curl_easy_setopt(file->handle.curl, CURLOPT_URL, file->url);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-		curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION,
-				write_callback);
-		curl_easy_setopt(file->handle.curl, CURLOPT_RESUME_FROM_LARGE,
-				file->pos);
-
-		/* restart */
-		curl_multi_add_handle(file->multi_handle, file->handle.curl);
-		curl_multi_perform(file->multi_handle, &file->still_running);
-
-		if ((file->buffer_pos == 0) && (!file->still_running)) {
-			/* if still_running is 0 now, we should return NULL */
-
-			/* make sure the easy handle is not in the multi handle anymore */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* cleanup */
-			curl_easy_cleanup(file->handle.curl);
-
-			free(file->buffer);/* free any allocated buffer space */
-			free(file->url);
-			if (file->cache_count != 0) {
-				for (int i = 0; i < file->cache_count; i++)
-					free(file->cache_list[i]);
-				free(file->cache_list);
-				free(file->cache_id_list);
-			}
-			free(file);
-
-			file = NULL;
-		}
+		file->eof_flag = false;
+		file->error_flag = false;
 		break;
 
 	default: /* unknown or supported type - oh dear */
@@ -1532,25 +3165,27 @@ int urlio_fseek(URLIO_FILE * file, long int offset, int origin) {
 		return fseek(file->handle.file, offset, origin); /* passthrough */
 		break;
 
-	case CFTYPE_CURL:
+	case CFTYPE_CURL: {
+		long int pos;
+
 		switch (origin) {
 		case SEEK_SET:
 #ifdef URLIO_VERBOSE
 			printf("fseek: seek to offset %ld from head\n", offset);
 #endif
-			file->pos = offset;
+			pos = offset;
 			break;
 		case SEEK_CUR:
 #ifdef URLIO_VERBOSE
 			printf("fseek: seek to offset %ld from position %ld\n", offset, file->pos);
 #endif
-			file->pos = file->pos + offset;
+			pos = file->pos + offset;
 			break;
 		case SEEK_END:
 #ifdef URLIO_VERBOSE
 			printf("fseek: seek to offset %ld from tail\n", offset);
 #endif
-			file->pos = file->size + offset;
+			pos = file->size + offset;
 			break;
 		default: /* unknown or supported type - oh dear */
 			errno = EBADF;
@@ -1558,57 +3193,18 @@ int urlio_fseek(URLIO_FILE * file, long int offset, int origin) {
 			break;
 		}
 
-		/* halt transaction */
-		curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-		/* ditch buffer - write will recreate - resets stream pos*/
-		free(file->buffer);
-		file->buffer = NULL;
-		file->buffer_pos = 0;
-		file->buffer_len = 0;
-
-		/* reset */
-		curl_easy_reset(file->handle.curl);
-		curl_easy_setopt(file->handle.curl, CURLOPT_URL, file->url);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-		curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION,
-				write_callback);
-		curl_easy_setopt(file->handle.curl, CURLOPT_RESUME_FROM_LARGE,
-				file->pos);
-
-		/* restart */
-		curl_multi_add_handle(file->multi_handle, file->handle.curl);
-
-		/* lets start the fetch again */
-		curl_multi_perform(file->multi_handle, &file->still_running);
-
-		if ((file->buffer_pos == 0) && (!file->still_running)) {
-			/* if still_running is 0 now, we should return NULL */
-
-			/* make sure the easy handle is not in the multi handle anymore */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* cleanup */
-			curl_easy_cleanup(file->handle.curl);
-
-			free(file->buffer);/* free any allocated buffer space */
-			free(file->url);
-			if (file->cache_count != 0) {
-				for (int i = 0; i < file->cache_count; i++)
-					free(file->cache_list[i]);
-				free(file->cache_list);
-				free(file->cache_id_list);
-			}
-			free(file);
-
-			file = NULL;
+		if (pos < 0) {
+			errno = EINVAL;
 			return -1;
 		}
 
+		/* only a position update; data is fetched when it is read */
+		file->pos = pos;
+		file->eof_flag = false;
+
 		return 0;
+	}
 
-		break;
 	default: /* unknown or supported type - oh dear */
 		errno = EBADF;
 		return -1;
@@ -1821,148 +3417,241 @@ int urlio_fseek(URLIO_FILE * file, long int offset, int origin) {
 //}
 
 
-// GMutex fread_mutex[THREAD_NUM];
-// GCond fread_cond[THREAD_NUM];
-GThread *gfreadthread[THREAD_NUM];
-
-GMutex fread_thread_mutex;
-GMutex fread_main_mutex;
-GCond fread_main_cond;
-bool freadThreadSetFlag[THREAD_NUM];
-bool freadThreadGoodFlag[THREAD_NUM];
-
-static void *fread_thread(FCURL_DATA *data) {
-#ifdef URLIO_VERBOSE
-	printf("thread %d started for reading %ld byte(s) from position %ld...\n", data->tid, data->want, data->pos);
-#endif
-
-	/* halt transaction */
-	curl_multi_remove_handle(data->multi_handle, data->handle.curl);
+/* sequential readahead
+ *
+ * Each remote handle watches which block its reads land in.  A read of the
+ * block after the previous one starts (or continues) a run; every time the
+ * run gets within a window of the furthest block already requested, the
+ * next window of blocks is handed to a small pool of readahead threads and
+ * the window doubles, up to a cap.  A read anywhere else halves the window
+ * and stops issuing, so random tile access costs nothing extra.
+ */
+static struct {
+	GMutex lock; /* also guards the ra_ fields of every handle */
+	GThreadPool *pool;
+	int max_window; /* blocks; 0 disables readahead */
+} readahead;
+
+struct readahead_job {
+	URLIO_FILE *file; /* holds a registry reference */
+	int64_t block_id;
+};
 
-	/* ditch buffer - write will recreate - resets stream pos*/
-	free(data->buffer);
-	data->buffer = NULL;
-	data->buffer_pos = 0;
-	data->buffer_len = 0;
+static void readahead_worker(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+	struct readahead_job *job = data;
 
-	/* reset */
-	curl_easy_reset(data->handle.curl);
-	curl_easy_setopt(data->handle.curl, CURLOPT_URL, data->url);
-	curl_easy_setopt(data->handle.curl, CURLOPT_WRITEDATA, data);
-	curl_easy_setopt(data->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-	curl_easy_setopt(data->handle.curl, CURLOPT_WRITEFUNCTION,
-			write_callback);
-	curl_easy_setopt(data->handle.curl, CURLOPT_RESUME_FROM_LARGE,
-			data->pos);
+	struct urlio_block *block = urlio_get_block(job->file, job->block_id);
+	if (block) {
+		urlio_block_unref(block);
+	}
 
-	/* restart */
-	curl_multi_add_handle(data->multi_handle, data->handle.curl);
+	urlio_fclose(job->file);
+	g_slice_free(struct readahead_job, job);
+}
 
-	/* lets start the fetch again */
-	curl_multi_perform(data->multi_handle, &data->still_running);
+static void readahead_init(void) {
+	static gsize initialized;
 
-	if ((data->buffer_pos == 0) && (!data->still_running)) {
-		/* if still_running is 0 now, we should return NULL */
+	if (g_once_init_enter(&initialized)) {
+		readahead.max_window = URLIO_READAHEAD_MAX / CACHE_SIZE;
 
-		/* make sure the easy handle is not in the multi handle anymore */
-		curl_multi_remove_handle(data->multi_handle, data->handle.curl);
+		const char *env = g_getenv(URLIO_READAHEAD_ENV_VAR);
+		if (env) {
+			char *endptr;
+			guint64 mb = g_ascii_strtoull(env, &endptr, 10);
+			if (env[0] && !endptr[0] && mb <= G_MAXINT / 1024) {
+				readahead.max_window = ((int64_t) mb << 20) / CACHE_SIZE;
+			} else {
+				g_warning("Ignoring invalid %s: %s", URLIO_READAHEAD_ENV_VAR, env);
+			}
+		}
 
-		/* cleanup */
-		curl_easy_cleanup(data->handle.curl);
+		/* each thread keeps THREAD_NUM fetch jobs busy; leave room for
+		 * demand misses */
+		readahead.pool = g_thread_pool_new(readahead_worker, NULL,
+				URLIO_READAHEAD_THREADS, FALSE, NULL);
+		g_once_init_leave(&initialized, 1);
+	}
+}
 
-		free(data->buffer);/* free any allocated buffer space */
-		free(data->url);
+/* note a read of block_id and start fetching ahead of a sequential run */
+static void readahead_note(URLIO_FILE *file, int64_t block_id) {
+	readahead_init();
 
-		free(data);
+	g_mutex_lock(&readahead.lock);
+	if (block_id == file->ra_last) {
+		g_mutex_unlock(&readahead.lock);
+		return;
+	}
+	bool sequential = (block_id == file->ra_last + 1);
+	file->ra_last = block_id;
+
+	if (!sequential || readahead.max_window == 0) {
+		file->ra_window /= 2;
+		file->ra_issued = block_id + 1;
+		g_mutex_unlock(&readahead.lock);
+		return;
+	}
 
-		data = NULL;
-		return 0;
+	/* wait until the run has used up half of what was requested */
+	if (file->ra_issued - (block_id + 1) > file->ra_window / 2) {
+		g_mutex_unlock(&readahead.lock);
+		return;
+	}
+	file->ra_window = CLAMP(2 * file->ra_window, 1, readahead.max_window);
+
+	/* stay well inside the block cache, or readahead evicts itself */
+	int64_t cache_window = urlio_get_cache_capacity() / CACHE_SIZE / 4;
+	int64_t end = (int64_t) ((file->size + CACHE_SIZE - 1) / CACHE_SIZE);
+	int64_t start = MAX(file->ra_issued, block_id + 1);
+	int64_t stop = MIN(block_id + 1 + MIN(file->ra_window, cache_window), end);
+
+	GSList *jobs = NULL;
+	for (int64_t id = start; id < stop; id++) {
+		struct readahead_job *job = g_slice_new(struct readahead_job);
+		job->file = file;
+		job->block_id = id;
+		jobs = g_slist_prepend(jobs, job);
 	}
+	file->ra_issued = MAX(file->ra_issued, stop);
+	g_mutex_unlock(&readahead.lock);
 
-	/* fill cache */
+	if (jobs == NULL) {
+		return;
+	}
 
-	if((size_t)data->pos < (size_t)data->size) {
-		if((data->pos+data->want-1)>data->size) {
 #ifdef URLIO_VERBOSE
-			printf("thread %d exceeds file end, reduce want from %lu to %lu...\n", data->tid, data->want, data->size - data->pos);
+	printf("readahead: blocks %" PRId64 "-%" PRId64 " of %s, window %d\n",
+			start, stop - 1, file->url, file->ra_window);
 #endif
 
-			data->want = data->size - data->pos;
-		}
+	/* jobs keep the handle registered until they finish */
+	g_mutex_lock(&url_registry.lock);
+	file->refcount += g_slist_length(jobs);
+	g_mutex_unlock(&url_registry.lock);
 
-		for (int retry = 0; retry < RETRY_TIMES; retry++) {
-			fill_buffer_thread(data, data->want);
-			if (data->buffer_pos) {
-				break;
-			}
-			else {
-#ifdef URLIO_VERBOSE
-				printf("thread %d retry %d time(s)...\n", data->tid, retry+1);
-#endif
-				// sleep(1);
-			}
+	jobs = g_slist_reverse(jobs);
+	for (GSList *l = jobs; l; l = l->next) {
+		g_thread_pool_push(readahead.pool, l->data, NULL);
+	}
+	g_slist_free(jobs);
+}
 
-			/* halt transaction */
-			curl_multi_remove_handle(data->multi_handle, data->handle.curl);
+/* true while the handle is in a sequential run */
+static bool readahead_active(URLIO_FILE *file) {
+	g_mutex_lock(&readahead.lock);
+	bool active = file->ra_window > 0;
+	g_mutex_unlock(&readahead.lock);
+	return active;
+}
 
-			/* ditch buffer - write will recreate - resets stream pos*/
-			free(data->buffer);
-			data->buffer = NULL;
-			data->buffer_pos = 0;
-			data->buffer_len = 0;
+/* positional read of a local file, leaving its stream position alone */
+static size_t local_pread(FILE *f, void *ptr, size_t len, long int offset) {
+#ifdef G_OS_WIN32
+	/* no pread(); serialize seek + read instead */
+	static GMutex lock;
+	g_mutex_lock(&lock);
+	off_t saved = ftello(f);
+	size_t count = 0;
+	if (fseeko(f, offset, SEEK_SET) == 0)
+		count = fread(ptr, 1, len, f);
+	fseeko(f, saved, SEEK_SET);
+	g_mutex_unlock(&lock);
+	return count;
+#else
+	size_t count = 0;
+	while (count < len) {
+		ssize_t ret = pread(fileno(f), (char*)ptr + count, len - count,
+				offset + count);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		count += ret;
+	}
+	return count;
+#endif
+}
 
-			/* restart */
-			curl_multi_add_handle(data->multi_handle, data->handle.curl);
+/* lend [offset, offset + len) from one cached block, stopping at the block
+ * end; *failed distinguishes a failed fetch from end of file */
+static size_t urlio_view_at(URLIO_FILE *file, long int offset, size_t len,
+		const char **data, struct urlio_block **block, bool *failed) {
+	*data = NULL;
+	*block = NULL;
+	if (len == 0 || offset < 0)
+		return 0;
 
-			/* lets start the fetch again */
-			curl_multi_perform(data->multi_handle, &data->still_running);
+	if (file->type == CFTYPE_FILE) {
+		/* local files have no cache to lend from; read into a private
+		 * block, in bounded pieces */
+		struct urlio_block *b = g_slice_new(struct urlio_block);
+		b->refcount = 1;
+		b->len = MIN(len, THREAD_CACHE_SIZE);
+		b->data = (char*) malloc(b->len * sizeof(char));
+		b->len = local_pread(file->handle.file, b->data, b->len, offset);
+		if (b->len == 0) {
+			urlio_block_unref(b);
+			return 0;
 		}
+		*data = b->data;
+		*block = b;
+		return b->len;
+	}
 
-		if (data->buffer_pos) {
-			/* ensure only available data is considered */
-			if (data->buffer_pos < data->want)
-				data->want = data->buffer_pos;
-
-			/* xfer data to caller */
-			memcpy(data->cache, data->buffer, data->want * sizeof(char));
-
-			use_buffer_thread(data, data->want);
-
-			freadThreadGoodFlag[data->tid] = true;
-		}
-		else {
-			freadThreadGoodFlag[data->tid] = false;
+	int64_t block_id = offset / CACHE_SIZE;
+	size_t block_offset = offset - block_id * CACHE_SIZE;
+
+	readahead_note(file, block_id);
+	struct urlio_block *b = block_cache_get(file, block_id);
+	if (b == NULL) {
+		/* lend from a range that has the first byte rather than fetch
+		 * the block; the caller comes back for the rest */
+		size_t skip;
+		b = range_cache_find(file, offset, 1, &skip);
+		if (b) {
+			*data = b->data + skip;
+			*block = b;
+			return MIN(len, b->len - skip);
 		}
+		b = urlio_get_block(file, block_id);
 	}
-	else {
-#ifdef URLIO_VERBOSE
-		printf("thread %d position out of range...\n", data->tid);
-#endif
-		data->want = 0;
-		freadThreadGoodFlag[data->tid] = true;
+	if (b == NULL) {
+		*failed = true;
+		return 0;
+	}
+	if (block_offset >= b->len) {
+		urlio_block_unref(b);
+		return 0;
 	}
 
-#ifdef URLIO_VERBOSE
-	printf("thread %d finished...\n", data->tid);
-#endif
-
-	freadThreadSetFlag[data->tid] = true;
-	bool freadThreadAllSetFlag = true;
-
-	g_mutex_lock (&fread_thread_mutex);
+	size_t count = MIN(len, b->len - block_offset);
+	*data = b->data + block_offset;
+	*block = b;
+	return count;
+}
 
-	for(int t = 0; t < THREAD_NUM; t ++) freadThreadAllSetFlag &= freadThreadSetFlag[t];
+/* copy [offset, offset + len) out of the block cache, short at end of file
+ * or when a fetch fails */
+static size_t urlio_read_at(URLIO_FILE *file, void *ptr, size_t len,
+		long int offset, bool *failed) {
+	size_t copied = 0;
+
+	while (copied < len) {
+		const char *data;
+		struct urlio_block *block;
+		size_t count = urlio_view_at(file, offset + copied, len - copied,
+				&data, &block, failed);
+		if (count == 0)
+			break;
 
-	if(freadThreadAllSetFlag) {
-		g_mutex_lock (&fread_main_mutex);
-		g_cond_signal (&fread_main_cond);
-		g_mutex_unlock (&fread_main_mutex);
+		memcpy((char*)ptr + copied, data, count);
+		urlio_block_unref(block);
+		copied += count;
 	}
-
-	g_mutex_unlock (&fread_thread_mutex);
+	return copied;
 }
 
-
 size_t urlio_fread(void *ptr, size_t size, size_t nmemb, URLIO_FILE *file) {
 	if(file->type == CFTYPE_FILE) {
 #ifdef URLIO_VERBOSE
@@ -1971,162 +3660,311 @@ size_t urlio_fread(void *ptr, size_t size, size_t nmemb, URLIO_FILE *file) {
 		return fread(ptr, size, nmemb, file->handle.file);
 	}
 	else {
-		long int orig_pointer = file->pos;
 		size_t orig_size = size * nmemb;
+		bool failed = false;
 
-		size_t current_size = orig_size;
-		long int current_pointer = file->pos;
-		long int ptr_pointer = 0;
-		long int copied_size = 0;
-
-
-
-		int cache_count = (((file->pos % CACHE_SIZE) + (size * nmemb) - 1)
-				/ CACHE_SIZE) + 1;
+		size_t copied_size = urlio_read_at(file, ptr, orig_size, file->pos,
+				&failed);
+		if (failed) {
+#ifdef URLIO_VERBOSE
+			printf("fread: failed\n");
+#endif
+			file->error_flag = true;
+		} else if (copied_size < orig_size) {
+			/* a short block means we have reached the end of the file */
+			file->eof_flag = true;
+		}
 
-		for (int i = 0; i < cache_count; i++) {
-			long int cache_id = (current_pointer / CACHE_SIZE) * CACHE_SIZE;
+		file->pos += copied_size;
 
-			int cache_index = -1;
+		return copied_size / size;
+	}
+}
 
-			for (int j = 0; j < file->cache_count; j++) {
-				if (file->cache_id_list[j] == cache_id) {
-					cache_index = j;
-#ifdef URLIO_VERBOSE
-					printf("fread: reading %zu byte(s) from position %ld cache hit\n", size, file->pos);
-#endif
-					break;
-				}
-			}
+/* length of the file, without moving the position; -1 on error */
+int64_t urlio_fsize(URLIO_FILE *file) {
+	if (file->type == CFTYPE_FILE) {
+		struct stat st;
+		if (fstat(fileno(file->handle.file), &st))
+			return -1;
+		return st.st_size;
+	}
+	return file->size;
+}
 
+/* Read len bytes at offset without touching the file position or flags.
+ * Safe to call from any number of threads on one handle.  Returns the
+ * bytes read; a short count is end of file, or a failed fetch with errno
+ * set to EIO. */
+size_t urlio_pread(URLIO_FILE *file, void *ptr, size_t len, long int offset) {
+	if (offset < 0) {
+		errno = EINVAL;
+		return 0;
+	}
 
-			if (cache_index == -1) {
-#ifdef URLIO_VERBOSE
-				printf("fread: reading %zu byte(s) from position %ld cache miss, start %d-thread(s) downloading\n", size, file->pos, THREAD_NUM);
-#endif
+	if (file->type == CFTYPE_FILE)
+		return local_pread(file->handle.file, ptr, len, offset);
 
-				char *thread_cache = (char*) malloc(CACHE_SIZE * sizeof(char));
-				size_t thread_want = CACHE_SIZE;
+	bool failed = false;
+	size_t count = urlio_read_at(file, ptr, len, offset, &failed);
+	if (failed)
+		errno = EIO;
+	return count;
+}
 
-				for(int t = 0; t < THREAD_NUM; t ++) {
-					file->fcurl_data[t]->pos = cache_id+t*THREAD_CACHE_SIZE;
-					file->fcurl_data[t]->want = THREAD_CACHE_SIZE;
-					freadThreadSetFlag[t] = false;
-				}
+/* Positional urlio_fview(): borrow up to len bytes at offset, leaving the
+ * file position alone.  0 is end of file, or a failed fetch with errno set
+ * to EIO. */
+size_t urlio_pview(URLIO_FILE *file, long int offset, size_t len,
+		const char **data, struct urlio_block **block) {
+	bool failed = false;
+	size_t count = urlio_view_at(file, offset, len, data, block, &failed);
+	if (failed)
+		errno = EIO;
+	return count;
+}
 
-				g_mutex_lock (&fread_main_mutex);
+/* Borrow up to len bytes at the current position without copying them.
+ * The view ends early at a block boundary or end of file, so callers loop
+ * the way they would with fread.  On success *data points into *block,
+ * which stays valid until released with urlio_block_unref(); 0 means end of
+ * file or an error, as reported by urlio_feof/urlio_ferror. */
+size_t urlio_fview(URLIO_FILE *file, size_t len, const char **data,
+		struct urlio_block **block) {
+	long int pos = (file->type == CFTYPE_FILE) ?
+			ftello(file->handle.file) : file->pos;
+	bool failed = false;
+
+	size_t count = urlio_view_at(file, pos, len, data, block, &failed);
+	if (file->type == CFTYPE_FILE) {
+		fseeko(file->handle.file, pos + count, SEEK_SET);
+		return count;
+	}
 
-				for(int t = 0; t < THREAD_NUM; t ++) {
-					gfreadthread[t] = g_thread_new("fread thread", &fread_thread, file->fcurl_data[t]);
-				}
+	if (failed) {
+		file->error_flag = true;
+	} else if (count == 0 && len) {
+		file->eof_flag = true;
+	}
+	file->pos += count;
+	return count;
+}
 
-				g_cond_wait (&fread_main_cond, &fread_main_mutex);
-				g_mutex_unlock (&fread_main_mutex);
+/* pull [offset, offset + len) into the block cache without copying it out;
+ * the file position is untouched */
+int urlio_fprefetch(URLIO_FILE *file, long int offset, size_t len) {
+	if (file->type != CFTYPE_CURL || len == 0)
+		return 0;
 
-				for(int t = 0; t < THREAD_NUM; t ++) {
-					if(!freadThreadGoodFlag[t]) {
-#ifdef URLIO_VERBOSE
-						printf("fread: failed\n");
-#endif
-						return 0;
-					}
-				}
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
 
-				thread_want = 0;
-				for(int t = 0; t < THREAD_NUM; t ++) {
-					memcpy(thread_cache+thread_want, file->fcurl_data[t]->cache, file->fcurl_data[t]->want * sizeof(char));
-					thread_want += file->fcurl_data[t]->want;
-				}
+	int64_t first = offset / CACHE_SIZE;
+	int64_t last = (offset + len - 1) / CACHE_SIZE;
+	if (file->size > 0)
+		last = MIN(last, (int64_t) ((file->size - 1) / CACHE_SIZE));
 
-				/* add cache into list */
+	for (int64_t block_id = first; block_id <= last; block_id++) {
+		struct urlio_block *block = urlio_get_block(file, block_id);
+		if (block == NULL) {
+			errno = EIO;
+			return -1;
+		}
+		urlio_block_unref(block);
+	}
+	return 0;
+}
 
-				if (file->cache_count == 0) {
-					file->cache_list = (char**) malloc(CACHE_SIZE * sizeof(char*));
-					file->cache_id_list = (long int*) malloc(sizeof(long int));
-				} else {
-					file->cache_list = (char**) realloc(file->cache_list,
-							(file->cache_count + 1) * CACHE_SIZE * sizeof(char*));
-					file->cache_id_list = (long int*) realloc(file->cache_id_list,
-							(file->cache_count + 1) * sizeof(long int));
-				}
+/* Borrow exactly [offset, offset + len), for reads whose extent is known up
+ * front, such as a TIFF tile.  Unlike urlio_pview(), a miss downloads just
+ * those bytes rather than the surrounding block, except during a sequential
+ * run, where blocks and readahead do better.  Returns len, less at end of
+ * file, or 0 with errno set to EIO if the fetch failed; *block is released
+ * with urlio_block_unref(). */
+/* Copy len bytes at offset out of blocks block_id and block_id + 1 into a
+ * new private block, if both are cached; NULL if either is missing. */
+static struct urlio_block *block_cache_join(URLIO_FILE *file, int64_t block_id,
+		long int offset, size_t len) {
+	struct urlio_block *first = block_cache_get(file, block_id);
+	if (first == NULL)
+		return NULL;
+	struct urlio_block *second = block_cache_get(file, block_id + 1);
+	if (second == NULL || first->len < CACHE_SIZE) {
+		urlio_block_unref(first);
+		if (second)
+			urlio_block_unref(second);
+		return NULL;
+	}
 
-				file->cache_list[file->cache_count] = thread_cache;
-				file->cache_id_list[file->cache_count] = cache_id;
+	size_t block_offset = offset - block_id * CACHE_SIZE;
+	size_t head = CACHE_SIZE - block_offset;
+	size_t tail = MIN(len - head, second->len);
+	struct urlio_block *b = g_slice_new(struct urlio_block);
+	b->refcount = 1;
+	b->len = head + tail;
+	b->data = (char*) malloc(b->len * sizeof(char));
+	memcpy(b->data, first->data + block_offset, head);
+	memcpy(b->data + head, second->data, tail);
+	urlio_block_unref(first);
+	urlio_block_unref(second);
+	return b;
+}
 
-				cache_index = file->cache_count;
+size_t urlio_pview_range(URLIO_FILE *file, long int offset, size_t len,
+		const char **data, struct urlio_block **block) {
+	*data = NULL;
+	*block = NULL;
+	if (offset < 0) {
+		errno = EINVAL;
+		return 0;
+	}
+	if (len == 0)
+		return 0;
 
-				file->cache_count++;
+	struct urlio_block *b;
+	if (file->type == CFTYPE_FILE) {
+		b = g_slice_new(struct urlio_block);
+		b->refcount = 1;
+		b->data = (char*) malloc(len * sizeof(char));
+		b->len = local_pread(file->handle.file, b->data, len, offset);
+		if (b->len == 0) {
+			urlio_block_unref(b);
+			return 0;
+		}
+		*data = b->data;
+		*block = b;
+		return b->len;
+	}
 
+	/* serve from a whole block if one is here or about to be */
+	int64_t block_id = offset / CACHE_SIZE;
+	bool in_block = (int64_t) ((offset + len - 1) / CACHE_SIZE) == block_id;
+	readahead_note(file, block_id);
+	if (in_block) {
+		b = block_cache_get(file, block_id);
+		if (b == NULL && readahead_active(file)) {
+			b = urlio_get_block(file, block_id);
+			if (b == NULL) {
+				errno = EIO;
+				return 0;
 			}
-
-			char *src_ptr = (char*)&file->cache_list[cache_index][current_pointer
-					- file->cache_id_list[cache_index]];
-			char *dst_ptr = (char*)&ptr[ptr_pointer];
-
-			int current_copy_size = 0;
-			if (cache_id
-					== ((current_pointer + current_size - 1) / CACHE_SIZE)
-							* CACHE_SIZE)
-				current_copy_size = current_size;
-			else
-				current_copy_size = CACHE_SIZE
-						- (current_pointer - file->cache_id_list[cache_index]);
-
-			memcpy(dst_ptr, src_ptr, current_copy_size * sizeof(char));
-			copied_size += current_copy_size;
-
-			ptr_pointer += current_copy_size;
-			current_pointer += current_copy_size;
-			current_size -= current_copy_size;
-		}
-
-		/* halt transaction */
-		curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-		/* ditch buffer - write will recreate - resets stream pos*/
-		free(file->buffer);
-		file->buffer = NULL;
-		file->buffer_pos = 0;
-		file->buffer_len = 0;
-		file->pos = orig_pointer + orig_size;
-
-		/* reset */
-		curl_easy_reset(file->handle.curl);
-		curl_easy_setopt(file->handle.curl, CURLOPT_URL, file->url);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEDATA, file);
-		curl_easy_setopt(file->handle.curl, CURLOPT_VERBOSE, CURL_VERBOSE);
-		curl_easy_setopt(file->handle.curl, CURLOPT_WRITEFUNCTION, write_callback);
-		curl_easy_setopt(file->handle.curl, CURLOPT_RESUME_FROM_LARGE, file->pos);
-
-		/* restart */
-		curl_multi_add_handle(file->multi_handle, file->handle.curl);
-
-		/* lets start the fetch again */
-		curl_multi_perform(file->multi_handle, &file->still_running);
-
-		if ((file->buffer_pos == 0) && (!file->still_running)) {
-			/* if still_running is 0 now, we should return NULL */
-
-			/* make sure the easy handle is not in the multi handle anymore */
-			curl_multi_remove_handle(file->multi_handle, file->handle.curl);
-
-			/* cleanup */
-			curl_easy_cleanup(file->handle.curl);
-
-			free(file->url);
-			if (file->cache_list != NULL) {
-				for (int i = 0; i < file->cache_count; i++)
-					free(file->cache_list[i]);
-				free(file->cache_list);
-				free(file->cache_id_list);
+		}
+		if (b) {
+			size_t block_offset = offset - block_id * CACHE_SIZE;
+			if (block_offset >= b->len) {
+				urlio_block_unref(b);
+				return 0;
 			}
-			free(file);
+			*data = b->data + block_offset;
+			*block = b;
+			return MIN(len, b->len - block_offset);
+		}
+	} else if ((int64_t) ((offset + len - 1) / CACHE_SIZE) == block_id + 1) {
+		/* straddling two cached blocks; copy rather than refetch */
+		b = block_cache_join(file, block_id, offset, len);
+		if (b) {
+			*data = b->data;
+			*block = b;
+			return b->len;
+		}
+	}
 
-			file = NULL;
+	b = range_cache_get(file, offset, len);
+	if (b == NULL) {
+		size_t skip;
+		b = range_cache_find(file, offset, len, &skip);
+		if (b) {
+			*data = b->data + skip;
+			*block = b;
+			return len;
+		}
+	}
+	if (b == NULL) {
+		/* share the download with anyone else missing the same range */
+		struct urlio_inflight *flight = inflight_begin(file, RANGE_ID(offset), &b);
+		if (flight == NULL && b && b->len < len) {
+			/* they wanted less of it; fetch our own */
+			urlio_block_unref(b);
+			b = NULL;
+		} else if (flight == NULL && b == NULL) {
+			errno = EIO;
 			return 0;
 		}
-
-		return copied_size / size;
+		if (b == NULL) {
+			int64_t range_offset = offset;
+			int64_t range_len = len;
+			if (!range_fetch(file, 1, &range_offset, &range_len, &b)) {
+				b = NULL;
+			}
+			if (flight) {
+				inflight_end(flight, b);
+			}
+			if (b == NULL) {
+				errno = EIO;
+				return 0;
+			}
+		}
+	}
+	if (b->len == 0) {
+		urlio_block_unref(b);
+		return 0;
 	}
+	*data = b->data;
+	*block = b;
+	return MIN(len, b->len);
 }
 
+/* Pull count exact ranges into the cache the way urlio_pview_range() would
+ * fetch them, sharing requests between nearby ranges.  Ranges with a
+ * length of 0 are skipped.  Returns 0, or -1 with errno set. */
+int urlio_fprefetch_ranges(URLIO_FILE *file, int count,
+		const int64_t *offsets, const int64_t *lengths) {
+	if (file->type != CFTYPE_CURL)
+		return 0;
+
+	GArray *missing_offsets = g_array_new(FALSE, FALSE, sizeof(int64_t));
+	GArray *missing_lengths = g_array_new(FALSE, FALSE, sizeof(int64_t));
+	int ret = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (offsets[i] < 0 || lengths[i] < 0) {
+			errno = EINVAL;
+			ret = -1;
+			goto OUT;
+		}
+		if (lengths[i] == 0)
+			continue;
+
+		int64_t block_id = offsets[i] / CACHE_SIZE;
+		struct urlio_block *block = NULL;
+		if ((offsets[i] + lengths[i] - 1) / CACHE_SIZE == block_id)
+			block = block_cache_get(file, block_id);
+		if (block == NULL)
+			block = range_cache_get(file, offsets[i], lengths[i]);
+		if (block == NULL) {
+			size_t skip;
+			block = range_cache_find(file, offsets[i], lengths[i], &skip);
+		}
+		if (block) {
+			urlio_block_unref(block);
+			continue;
+		}
+
+		g_array_append_val(missing_offsets, offsets[i]);
+		g_array_append_val(missing_lengths, lengths[i]);
+	}
+
+	if (!range_fetch(file, missing_offsets->len,
+			(int64_t *) missing_offsets->data,
+			(int64_t *) missing_lengths->data, NULL)) {
+		errno = EIO;
+		ret = -1;
+	}
+
+OUT:
+	g_array_free(missing_offsets, TRUE);
+	g_array_free(missing_lengths, TRUE);
+	return ret;
+}
@@ -167,8 +167,9 @@ static bool decode_tile(struct level *l,
   // read raw tile
   void *buf;
   int32_t buflen;
+  struct urlio_block *block;
   if (!_openremoteslide_tiff_read_tile_data(tiffl, tiff,
-                                      &buf, &buflen,
+                                      &buf, &buflen, &block,
                                       tile_col, tile_row,
                                       err)) {
     return false;  // ok, haven't allocated anything yet
@@ -182,7 +183,7 @@ static bool decode_tile(struct level *l,
                                                err);
 
   // clean up
-  g_free(buf);
+  _openremoteslide_tiff_free_tile_data(buf, block);
 
   return success;
 }
@@ -255,6 +256,25 @@ static bool paint_region(openremoteslide_t *osr, cairo_t *cr,
     return false;
   }
 
+  // fetch the raw tiles of a remote region together rather than one by
+  // one; on failure, painting reports the error for the tile concerned
+  if (_openremoteslide_tiffcache_is_remote(data->tc)) {
+    struct _openremoteslide_tiff_level *tiffl = &l->tiffl;
+    double lx = x / l->base.downsample;
+    double ly = y / l->base.downsample;
+    GError *tmp_err = NULL;
+    if (!_openremoteslide_tiff_prefetch_tiles(data->tc, tiffl, tiff,
+                                        osr->cache, level,
+                                        floor(lx / tiffl->tile_w),
+                                        floor(ly / tiffl->tile_h),
+                                        ceil((lx + w) / tiffl->tile_w),
+                                        ceil((ly + h) / tiffl->tile_h),
+                                        NULL, &tmp_err)) {
+      g_debug("paint prefetch failed: %s", tmp_err->message);
+      g_clear_error(&tmp_err);
+    }
+  }
+
   bool success = _openremoteslide_grid_paint_region(l->grid, cr, tiff,
                                               x / l->base.downsample,
                                               y / l->base.downsample,
@@ -265,8 +285,40 @@ static bool paint_region(openremoteslide_t *osr, cairo_t *cr,
   return success;
 }
 
+static bool prefetch_region(openremoteslide_t *osr,
+                            int64_t x, int64_t y,
+                            struct _openremoteslide_level *level,
+                            int32_t w, int32_t h,
+                            volatile gint *cancelled,
+                            GError **err) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+  struct _openremoteslide_tiff_level *tiffl = &l->tiffl;
+
+  TIFF *tiff = _openremoteslide_tiffcache_get(data->tc, err);
+  if (tiff == NULL) {
+    return false;
+  }
+
+  // tiles covering the region in this level
+  double lx = x / l->base.downsample;
+  double ly = y / l->base.downsample;
+  bool success = _openremoteslide_tiff_prefetch_tiles(data->tc, tiffl, tiff,
+                                                osr->cache, level,
+                                                floor(lx / tiffl->tile_w),
+                                                floor(ly / tiffl->tile_h),
+                                                ceil((lx + w) / tiffl->tile_w),
+                                                ceil((ly + h) / tiffl->tile_h),
+                                                cancelled,
+                                                err);
+  _openremoteslide_tiffcache_put(data->tc, tiff);
+
+  return success;
+}
+
 static const struct _openremoteslide_ops aperio_ops = {
   .paint_region = paint_region,
+  .prefetch_region = prefetch_region,
   .destroy = destroy,
 };
 
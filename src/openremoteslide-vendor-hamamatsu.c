@@ -2239,7 +2239,8 @@ static bool hamamatsu_ndpi_open(openremoteslide_t *osr, const char *filename,
     goto FAIL;
   }
 
-  // walk directories
+  // walk directories, whose values we'll need
+  _openremoteslide_tifflike_prefetch_values(tl, NULL, 0);
   int64_t directories = _openremoteslide_tifflike_get_directory_count(tl);
   int64_t min_width = INT64_MAX;
   int64_t min_width_dir = 0;
@@ -968,15 +968,8 @@ static void *read_record_data(const char *path,
     return NULL;
   }
 
-  if (urlio_fseek(f, offset, SEEK_SET) == -1) {
-    g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
-                "Cannot seek data file");
-    urlio_fclose(f);
-    return NULL;
-  }
-
   buffer = g_malloc(size);
-  if (urlio_fread(buffer, sizeof(char), size, f) != (size_t) size) {
+  if (urlio_pread(f, buffer, size, offset) != (size_t) size) {
     g_set_error(err, OPENREMOTESLIDE_ERROR, OPENREMOTESLIDE_ERROR_FAILED,
                 "Error while reading data");
     g_free(buffer);
@@ -54,6 +54,8 @@ static const struct _openremoteslide_format *formats[] = {
 
 static bool openremoteslide_was_dynamically_loaded;
 
+static gint lazy_quickhash;  // atomic
+
 // called from shared-library constructor!
 static void __attribute__((constructor)) _openremoteslide_init(void) {
   // activate threads
@@ -87,8 +89,59 @@ static bool level_in_range(openremoteslide_t *osr, int32_t level) {
   return true;
 }
 
+struct _openremoteslide_prefetch {
+  GMutex *lock;
+  GCond *cond;
+  GHashTable *hints;  // id -> struct prefetch_hint, until its job finishes
+  int last_id;
+};
+
+struct prefetch_hint {
+  openremoteslide_t *osr;
+  int id;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  volatile gint cancelled;
+};
+
+static struct _openremoteslide_prefetch *prefetch_create(void) {
+  struct _openremoteslide_prefetch *pf =
+    g_slice_new0(struct _openremoteslide_prefetch);
+  pf->lock = g_mutex_new();
+  pf->cond = g_cond_new();
+  pf->hints = g_hash_table_new(g_direct_hash, g_direct_equal);
+  return pf;
+}
+
+static void cancel_hint(gpointer key G_GNUC_UNUSED,
+                        gpointer value,
+                        gpointer user_data G_GNUC_UNUSED) {
+  struct prefetch_hint *hint = value;
+
+  g_atomic_int_set(&hint->cancelled, 1);
+}
+
+// cancel everything and wait for the workers to let go of the slide
+static void prefetch_destroy(struct _openremoteslide_prefetch *pf) {
+  g_mutex_lock(pf->lock);
+  g_hash_table_foreach(pf->hints, cancel_hint, NULL);
+  while (g_hash_table_size(pf->hints)) {
+    g_cond_wait(pf->cond, pf->lock);
+  }
+  g_mutex_unlock(pf->lock);
+
+  g_hash_table_destroy(pf->hints);
+  g_cond_free(pf->cond);
+  g_mutex_free(pf->lock);
+  g_slice_free(struct _openremoteslide_prefetch, pf);
+}
+
 static openremoteslide_t *create_osr(void) {
   openremoteslide_t *osr = g_slice_new0(openremoteslide_t);
+  osr->prefetch = prefetch_create();
   osr->properties = g_hash_table_new_full(g_str_hash, g_str_equal,
                                           g_free, g_free);
   osr->associated_images = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -145,7 +198,11 @@ static bool open_backend(openremoteslide_t *osr,
                          struct _openremoteslide_hash **quickhash1_OUT,
                          GError **err) {
   if (quickhash1_OUT) {
-    *quickhash1_OUT = _openremoteslide_hash_quickhash1_create();
+    if (g_atomic_int_get(&lazy_quickhash)) {
+      *quickhash1_OUT = _openremoteslide_hash_quickhash1_create_deferred();
+    } else {
+      *quickhash1_OUT = _openremoteslide_hash_quickhash1_create();
+    }
   }
 
   bool result = format->open(osr, filename, tl,
@@ -290,13 +347,21 @@ openremoteslide_t *openremoteslide_open(const char *filename) {
   }
 
   // set hash property
-  const char *hash_str = _openremoteslide_hash_get_string(quickhash1);
-  if (hash_str != NULL) {
+  if (_openremoteslide_hash_is_deferred(quickhash1)) {
+    // list it now; openremoteslide_get_property_value() computes it
     g_hash_table_insert(osr->properties,
                         g_strdup(OPENREMOTESLIDE_PROPERTY_NAME_QUICKHASH1),
-                        g_strdup(hash_str));
+                        NULL);
+    osr->quickhash1 = quickhash1;
+  } else {
+    const char *hash_str = _openremoteslide_hash_get_string(quickhash1);
+    if (hash_str != NULL) {
+      g_hash_table_insert(osr->properties,
+                          g_strdup(OPENREMOTESLIDE_PROPERTY_NAME_QUICKHASH1),
+                          g_strdup(hash_str));
+    }
+    _openremoteslide_hash_destroy(quickhash1);
   }
-  _openremoteslide_hash_destroy(quickhash1);
 
   // set other properties
   g_hash_table_insert(osr->properties,
@@ -352,6 +417,9 @@ openremoteslide_t *openremoteslide_open(const char *filename) {
 
 
 void openremoteslide_close(openremoteslide_t *osr) {
+  // stop background work before the backend goes away
+  prefetch_destroy(osr->prefetch);
+
   if (osr->ops) {
     (osr->ops->destroy)(osr);
   }
@@ -366,12 +434,18 @@ void openremoteslide_close(openremoteslide_t *osr) {
     _openremoteslide_cache_destroy(osr->cache);
   }
 
+  if (osr->quickhash1) {
+    _openremoteslide_hash_destroy(osr->quickhash1);
+  }
+
   g_free(g_atomic_pointer_get(&osr->error));
 
-  g_slice_free(openremoteslide_t, osr);
+  if (osr->urlname) {
+    urlio_frelease(osr->urlname);
+    free((char *) osr->urlname);
+  }
 
-  urlio_frelease(osr->urlname);
-  free(osr->urlname);
+  g_slice_free(openremoteslide_t, osr);
 }
 
 
@@ -467,21 +541,6 @@ double openremoteslide_get_layer_downsample(openremoteslide_t *osr, int32_t leve
 }
 
 
-int openremoteslide_give_prefetch_hint(openremoteslide_t *osr G_GNUC_UNUSED,
-				 int64_t x G_GNUC_UNUSED,
-				 int64_t y G_GNUC_UNUSED,
-				 int32_t level G_GNUC_UNUSED,
-				 int64_t w G_GNUC_UNUSED,
-				 int64_t h G_GNUC_UNUSED) {
-  g_warning("openremoteslide_give_prefetch_hint has never been implemented and should not be called");
-  return 0;
-}
-
-void openremoteslide_cancel_prefetch_hint(openremoteslide_t *osr G_GNUC_UNUSED,
-				    int prefetch_id G_GNUC_UNUSED) {
-  g_warning("openremoteslide_cancel_prefetch_hint has never been implemented and should not be called");
-}
-
 static bool read_region(openremoteslide_t *osr,
 			cairo_t *cr,
 			int64_t x, int64_t y,
@@ -636,6 +695,143 @@ _OUT:
 }
 
 
+static bool run_prefetch_hint(struct prefetch_hint *hint, GError **err) {
+  openremoteslide_t *osr = hint->osr;
+  struct _openremoteslide_level *l = osr->levels[hint->level];
+  bool decode = osr->ops->prefetch_region == NULL ||
+                g_getenv(_OPENREMOTESLIDE_PREFETCH_DECODE_ENV_VAR) != NULL;
+
+  // work in pieces, so that cancellation takes effect quickly and
+  // decoding doesn't need a huge scratch surface
+  const int64_t d = 1024;
+  double ds = l->downsample;
+  for (int64_t row = 0; row < (hint->h + d - 1) / d; row++) {
+    for (int64_t col = 0; col < (hint->w + d - 1) / d; col++) {
+      if (g_atomic_int_get(&hint->cancelled)) {
+        return true;
+      }
+
+      int64_t sx = hint->x + col * d * ds;     // level 0 plane
+      int64_t sy = hint->y + row * d * ds;     // level 0 plane
+      int64_t sw = MIN(hint->w - col * d, d);  // level plane
+      int64_t sh = MIN(hint->h - row * d, d);  // level plane
+
+      if (!decode) {
+        if (!osr->ops->prefetch_region(osr, sx, sy, l, sw, sh,
+                                       &hint->cancelled, err)) {
+          return false;
+        }
+        continue;
+      }
+
+      // paint into a scratch surface; the tiles land in the tile cache
+      cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, sw, sh);
+      cairo_t *cr = cairo_create(surface);
+      cairo_surface_destroy(surface);
+      bool success = read_region(osr, cr, sx, sy, hint->level, sw, sh, err) &&
+                     _openremoteslide_check_cairo_status(cr, err);
+      cairo_destroy(cr);
+      if (!success) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void prefetch_worker(gpointer data,
+                            gpointer user_data G_GNUC_UNUSED) {
+  struct prefetch_hint *hint = data;
+  struct _openremoteslide_prefetch *pf = hint->osr->prefetch;
+  GError *tmp_err = NULL;
+
+  // failures are left for the eventual read to report
+  if (!run_prefetch_hint(hint, &tmp_err)) {
+    g_debug("prefetch %d failed: %s", hint->id, tmp_err->message);
+    g_clear_error(&tmp_err);
+  }
+
+  g_mutex_lock(pf->lock);
+  g_hash_table_remove(pf->hints, GINT_TO_POINTER(hint->id));
+  g_cond_broadcast(pf->cond);
+  g_mutex_unlock(pf->lock);
+
+  g_slice_free(struct prefetch_hint, hint);
+}
+
+static GThreadPool *get_prefetch_pool(void) {
+  static gsize pool = 0;
+
+  if (g_once_init_enter(&pool)) {
+    GThreadPool *p = g_thread_pool_new(prefetch_worker, NULL,
+                                       _OPENREMOTESLIDE_PREFETCH_THREADS,
+                                       FALSE, NULL);
+    g_once_init_leave(&pool, (gsize) p);
+  }
+  return (GThreadPool *) pool;
+}
+
+int openremoteslide_give_prefetch_hint(openremoteslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h) {
+  if (openremoteslide_get_error(osr) || !level_in_range(osr, level) ||
+      w <= 0 || h <= 0) {
+    return 0;
+  }
+
+  struct _openremoteslide_prefetch *pf = osr->prefetch;
+  struct prefetch_hint *hint = g_slice_new0(struct prefetch_hint);
+  hint->osr = osr;
+  hint->x = x;
+  hint->y = y;
+  hint->level = level;
+  hint->w = w;
+  hint->h = h;
+
+  g_mutex_lock(pf->lock);
+  // ids are positive; 0 means no hint
+  if (pf->last_id == G_MAXINT) {
+    pf->last_id = 0;
+  }
+  int id = ++pf->last_id;
+  hint->id = id;
+  g_hash_table_insert(pf->hints, GINT_TO_POINTER(id), hint);
+  g_mutex_unlock(pf->lock);
+
+  // the hint may be finished and freed as soon as it is pushed
+  g_thread_pool_push(get_prefetch_pool(), hint, NULL);
+  return id;
+}
+
+void openremoteslide_cancel_prefetch_hint(openremoteslide_t *osr,
+				    int prefetch_id) {
+  struct _openremoteslide_prefetch *pf = osr->prefetch;
+
+  g_mutex_lock(pf->lock);
+  struct prefetch_hint *hint = g_hash_table_lookup(pf->hints,
+                                                   GINT_TO_POINTER(prefetch_id));
+  if (hint) {
+    g_atomic_int_set(&hint->cancelled, 1);
+  }
+  g_mutex_unlock(pf->lock);
+}
+
+void openremoteslide_set_read_deadline(int64_t timeout_ms) {
+  urlio_set_deadline(timeout_ms);
+}
+
+void openremoteslide_set_slide_index(bool enabled) {
+  urlio_finitial();
+  urlio_set_indexing(enabled);
+}
+
+void openremoteslide_set_lazy_quickhash(bool enabled) {
+  g_atomic_int_set(&lazy_quickhash, enabled);
+}
+
+
 void openremoteslide_cairo_read_region(openremoteslide_t *osr,
 				 cairo_t *cr,
 				 int64_t x, int64_t y,
@@ -674,6 +870,11 @@ const char *openremoteslide_get_property_value(openremoteslide_t *osr, const cha
     return NULL;
   }
 
+  if (osr->quickhash1 &&
+      !strcmp(name, OPENREMOTESLIDE_PROPERTY_NAME_QUICKHASH1)) {
+    return _openremoteslide_hash_get_string(osr->quickhash1);
+  }
+
   return g_hash_table_lookup(osr->properties, name);
 }
 
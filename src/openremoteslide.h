@@ -179,6 +179,91 @@ void openremoteslide_read_region(openremoteslide_t *osr,
 			   int64_t w, int64_t h);
 
 
+/**
+ * Start fetching a region of a whole slide image in the background.
+ *
+ * The compressed data covering the region is read into the I/O cache, so
+ * that a later openremoteslide_read_region() of the same area does not wait
+ * on the network.  If the OPENREMOTESLIDE_PREFETCH_DECODE environment
+ * variable is set, or the slide format cannot locate its tile data, the
+ * tiles are also decoded into the tile cache.  Failures are not reported;
+ * a later read of the region will see them.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @return A positive id for openremoteslide_cancel_prefetch_hint(), or 0 if
+ *         no prefetch was started.
+ */
+OPENREMOTESLIDE_PUBLIC()
+int openremoteslide_give_prefetch_hint(openremoteslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h);
+
+/**
+ * Abandon a prefetch started by openremoteslide_give_prefetch_hint().
+ *
+ * Work that has not started is dropped and work in progress stops before
+ * its next batch of tiles; a batch already being fetched runs to
+ * completion.  Cancelling a hint that has already finished, or id 0, does
+ * nothing.
+ *
+ * @param osr The OpenSlide object.
+ * @param prefetch_id The id returned when the hint was given.
+ */
+OPENREMOTESLIDE_PUBLIC()
+void openremoteslide_cancel_prefetch_hint(openremoteslide_t *osr, int prefetch_id);
+
+/**
+ * Bound the time the calling thread's reads may spend on the network.
+ *
+ * Remote reads issued by this thread after the call give up once
+ * @p timeout_ms milliseconds have passed, instead of waiting out request
+ * timeouts and retries.  The deadline is absolute, so servers typically
+ * set it before each request they handle.  A read that runs out of time
+ * fails like any other read, putting the OpenSlide object into the error
+ * state; reopening a remote slide is cheap while its data is cached.
+ *
+ * @param timeout_ms Milliseconds from now, or 0 to remove the deadline.
+ */
+OPENREMOTESLIDE_PUBLIC()
+void openremoteslide_set_read_deadline(int64_t timeout_ms);
+
+/**
+ * Keep an index of each remote slide opened from now on.
+ *
+ * The index holds the slide's parsed TIFF directories, with their tile
+ * tables and property values, and openremoteslide_open() loads it instead
+ * of parsing the slide again over the network.  Indexes are kept in memory
+ * with the slide's cached data, and, if the disk cache is enabled with the
+ * OPENREMOTESLIDE_URLIO_DISK_CACHE_DIR environment variable, on disk
+ * across processes, keyed by URL and the server's ETag or Last-Modified
+ * date.  Setting OPENREMOTESLIDE_URLIO_INDEX=1 has the same effect.
+ *
+ * @param enabled Whether to keep and use indexes.
+ */
+OPENREMOTESLIDE_PUBLIC()
+void openremoteslide_set_slide_index(bool enabled);
+
+/**
+ * Defer the quickhash of slides opened from now on until it is read.
+ *
+ * Computing the quickhash-1 property reads the slide's smallest level,
+ * which for a remote slide is most of the work of openremoteslide_open().
+ * With deferral enabled, the property is listed as usual but computed by
+ * the first openremoteslide_get_property_value() call that asks for it.
+ * If the slide cannot be read at that point, the property's value is NULL.
+ *
+ * @param enabled Whether to defer the quickhash.
+ */
+OPENREMOTESLIDE_PUBLIC()
+void openremoteslide_set_lazy_quickhash(bool enabled);
+
+
 /**
  * Close an OpenSlide object.
  * No other threads may be using the object.
@@ -559,17 +644,6 @@ const char *openremoteslide_get_comment(openremoteslide_t *osr);
 
 //@}
 
-#ifndef OPENREMOTESLIDE_SIMPLIFY_HEADERS
-// these are meant to throw compile- and link-time errors,
-// since the functions they replace were never implemented
-int _openremoteslide_give_prefetch_hint_UNIMPLEMENTED(void);
-void _openremoteslide_cancel_prefetch_hint_UNIMPLEMENTED(void);
-#define openremoteslide_give_prefetch_hint(osr, x, y, level, w, h)	\
-  _openremoteslide_give_prefetch_hint_UNIMPLEMENTED(-1);
-#define openremoteslide_cancel_prefetch_hint(osr, prefetch_id)	\
-  _openremoteslide_cancel_prefetch_hint_UNIMPLEMENTED(-1)
-#endif
-
 /**
  * @mainpage OpenSlide
  *
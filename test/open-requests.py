@@ -0,0 +1,187 @@
+#!/usr/bin/env python
+#
+# OpenSlide, a library for reading whole slide image files
+#
+# Copyright (c) 2012-2015 Carnegie Mellon University
+# All rights reserved.
+#
+# OpenSlide is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, version 2.1.
+#
+# OpenSlide is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with OpenSlide. If not, see
+# <http://www.gnu.org/licenses/>.
+#
+
+# Count the HTTP requests needed to open a remote slide.  Writes a
+# synthetic four-level SVS-like pyramid of about 57 MB, with each level's
+# IFD after its tile data, serves it with test/range-server.py, and runs
+#   test/urlio-open <url>
+# against it.  Fails if opening took more than --max requests, or if
+# opening it again while the server answers 404 takes more than one.
+#
+# Detection fetches the IFDs and their out-of-line values as exact ranges
+# (one request after the first block); libtiff's directory reads should
+# then come from those ranges.  Reading them a block at a time instead
+# takes 11 requests here.
+
+from __future__ import print_function
+from optparse import OptionParser
+import os
+import runpy
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+LEVELS = [(46000, 32914), (11500, 8228), (2875, 2057), (718, 514)]
+TILE = 240
+TILE_BYTES = 2000
+
+
+def write_slide(path):
+    out = bytearray(b'II*\0\0\0\0\0')
+    ifd_offsets = []
+
+    def pad():
+        if len(out) % 2:
+            out.append(0)
+
+    for w, h in LEVELS:
+        count = ((w + TILE - 1) // TILE) * ((h + TILE - 1) // TILE)
+        data_offset = len(out)
+        out.extend(b'\x11' * (count * TILE_BYTES))
+        pad()
+
+        desc = ('Aperio Image Library v10.0.50\r\n'
+                '%dx%d [0,0 %dx%d] (%dx%d) JPEG/RGB Q=70|AppMag = 20|'
+                'MPP = 0.499' % (w, h, w, h, TILE, TILE)).encode('ascii')
+        desc += b'\0'
+        values = {
+            258: struct.pack('<3H', 8, 8, 8),
+            270: desc,
+            324: struct.pack('<%dI' % count,
+                    *[data_offset + i * TILE_BYTES for i in range(count)]),
+            325: struct.pack('<%dI' % count, *[TILE_BYTES] * count),
+        }
+        # (tag, type, count, value); None for a value in `values`
+        entries = [
+            (256, 4, 1, w), (257, 4, 1, h), (258, 3, 3, None),
+            (259, 3, 1, 1), (262, 3, 1, 2), (270, 2, len(desc), None),
+            (277, 3, 1, 3), (284, 3, 1, 1), (322, 3, 1, TILE),
+            (323, 3, 1, TILE), (324, 4, count, None), (325, 4, count, None),
+        ]
+
+        # the IFD, then its out-of-line values
+        ifd_offset = len(out)
+        ifd_offsets.append(ifd_offset)
+        value_offset = ifd_offset + 2 + 12 * len(entries) + 4
+        ifd = bytearray(struct.pack('<H', len(entries)))
+        tail = bytearray()
+        for tag, typ, n, value in entries:
+            if value is not None:
+                fmt = '<HHIHH' if typ == 3 else '<HHII'
+                args = (value, 0) if typ == 3 else (value,)
+                ifd += struct.pack(fmt, tag, typ, n, *args)
+                continue
+            blob = values[tag]
+            if len(blob) <= 4:
+                ifd += struct.pack('<HHI', tag, typ, n) + blob.ljust(4, b'\0')
+                continue
+            ifd += struct.pack('<HHII', tag, typ, n, value_offset + len(tail))
+            tail += blob
+            if len(tail) % 2:
+                tail.append(0)
+        ifd += b'\0\0\0\0'
+        out.extend(ifd)
+        out.extend(tail)
+        pad()
+
+    # link the IFDs
+    struct.pack_into('<I', out, 4, ifd_offsets[0])
+    for cur, nxt in zip(ifd_offsets, ifd_offsets[1:]):
+        n = struct.unpack_from('<H', out, cur)[0]
+        struct.pack_into('<I', out, cur + 2 + 12 * n, nxt)
+
+    with open(path, 'wb') as fh:
+        fh.write(out)
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage='%prog [options] <urlio-open>')
+    parser.add_option('-m', '--max', type='int', default=2,
+            help='most requests opening may take [2]')
+    parser.add_option('-d', '--delay', type='float', default=0.05,
+            help='seconds of latency to add to each request [0.05]')
+    opts, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('missing program')
+
+    here = os.path.dirname(os.path.abspath(__file__))
+    server_mod = runpy.run_path(os.path.join(here, 'range-server.py'))
+    requests = []
+
+    class CountingHandler(server_mod['RangeHandler']):
+        def do_GET(self):
+            requests.append(self.headers.get('Range'))
+            server_mod['RangeHandler'].do_GET(self)
+
+        def log_message(self, format, *args):
+            pass
+
+    root = tempfile.mkdtemp(prefix='open-requests-')
+    try:
+        write_slide(os.path.join(root, 'slide.svs'))
+
+        server = server_mod['ThreadedHTTPServer'](('127.0.0.1', 0),
+                CountingHandler)
+        server.root = root
+        server.delay = opts.delay
+        server.fail = 0
+        server.fail_status = 503
+        server.stall = 0
+        server.stall_time = 0
+        server.single_range = False
+        thread = threading.Thread(target=server.serve_forever)
+        thread.daemon = True
+        thread.start()
+
+        url = 'http://127.0.0.1:%d/slide.svs' % server.server_address[1]
+        # default urlio settings, and so no disk cache
+        env = dict((k, v) for k, v in os.environ.items()
+                if not k.startswith('OPENREMOTESLIDE_URLIO_'))
+        ret = subprocess.call([args[0], url], env=env)
+        opened = requests[:]
+
+        # a permanent error should fail the open without retries
+        del requests[:]
+        server.fail = 1
+        server.fail_status = 404
+        start = time.time()
+        missing_ret = subprocess.call([args[0], url], env=env)
+        missing_time = time.time() - start
+        missing = requests[:]
+        server.shutdown()
+    finally:
+        shutil.rmtree(root)
+
+    for r in opened:
+        print('  Range: %s' % r)
+    print('%d request(s), at most %d expected' % (len(opened), opts.max))
+    print('404: %d request(s) in %.2f s, 1 expected' %
+            (len(missing), missing_time))
+    if ret:
+        sys.exit(ret)
+    if len(opened) > opts.max:
+        sys.exit(1)
+    if not missing_ret or len(missing) != 1:
+        sys.exit(1)
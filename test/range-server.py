@@ -0,0 +1,213 @@
+#!/usr/bin/env python
+#
+# OpenSlide, a library for reading whole slide image files
+#
+# Copyright (c) 2012-2015 Carnegie Mellon University
+# All rights reserved.
+#
+# OpenSlide is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation, version 2.1.
+#
+# OpenSlide is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with OpenSlide. If not, see
+# <http://www.gnu.org/licenses/>.
+#
+
+# Threaded HTTP server with byte-range support, for benchmarking remote
+# slide access against a local directory.  --delay adds a fixed per-request
+# latency to approximate an object store; --fail and --stall inject faults
+# to exercise timeouts, retries and hedging.  --fail-status 404 instead
+# makes failures permanent, which clients should report without retrying.
+
+from __future__ import print_function
+from optparse import OptionParser
+import os
+import random
+import re
+import time
+
+try:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    from urlparse import urlsplit
+    from urllib import unquote
+except ImportError:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    from urllib.parse import urlsplit, unquote
+
+RANGE_RE = re.compile(r'^(\d*)-(\d*)$')
+BOUNDARY = 'RANGE_SERVER_BOUNDARY'
+
+
+class ThreadedHTTPServer(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+
+
+class RangeHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def _path(self):
+        path = unquote(urlsplit(self.path).path).lstrip('/')
+        path = os.path.normpath(os.path.join(self.server.root, path))
+        if not path.startswith(self.server.root + os.sep):
+            return None
+        return path
+
+    def _ranges(self, size):
+        # list of (start, end) pairs, None for the whole file, or [] if
+        # nothing requested is satisfiable
+        header = self.headers.get('Range') or ''
+        if not header.startswith('bytes='):
+            return None
+        ranges = []
+        for spec in header[len('bytes='):].split(','):
+            match = RANGE_RE.match(spec.strip())
+            if not match or not (match.group(1) or match.group(2)):
+                return None
+            if match.group(1):
+                start = int(match.group(1))
+                end = size - 1
+                if match.group(2):
+                    end = min(int(match.group(2)), size - 1)
+            else:
+                start = max(size - int(match.group(2)), 0)
+                end = size - 1
+            if start < size:
+                ranges.append((start, end))
+        return ranges
+
+    def _copy(self, fh, start, end):
+        fh.seek(start)
+        remaining = end - start + 1
+        while remaining > 0:
+            buf = fh.read(min(remaining, 1 << 16))
+            if not buf:
+                break
+            self.wfile.write(buf)
+            remaining -= len(buf)
+
+    def _send(self, body):
+        time.sleep(self.server.delay)
+        if random.random() < self.server.fail:
+            self.send_error(self.server.fail_status)
+            return
+        path = self._path()
+        if path is None or not os.path.isfile(path):
+            self.send_error(404)
+            return
+        size = os.path.getsize(path)
+        ranges = self._ranges(size)
+        if ranges == []:
+            self.send_response(416)
+            self.send_header('Content-Range', 'bytes */%d' % size)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+        if ranges and len(ranges) > 1 and self.server.single_range:
+            ranges = None
+
+        # one part header per range for multipart/byteranges
+        parts = []
+        if ranges and len(ranges) > 1:
+            for start, end in ranges:
+                parts.append(('\r\n--%s\r\n'
+                        'Content-Type: application/octet-stream\r\n'
+                        'Content-Range: bytes %d-%d/%d\r\n\r\n' %
+                        (BOUNDARY, start, end, size)).encode('ascii'))
+            trailer = ('\r\n--%s--\r\n' % BOUNDARY).encode('ascii')
+            length = sum(len(p) for p in parts) + len(trailer) + \
+                    sum(end - start + 1 for start, end in ranges)
+        elif ranges:
+            length = ranges[0][1] - ranges[0][0] + 1
+        else:
+            length = size
+
+        self.send_response(206 if ranges else 200)
+        if parts:
+            self.send_header('Content-Type',
+                    'multipart/byteranges; boundary=%s' % BOUNDARY)
+        else:
+            self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Accept-Ranges', 'bytes')
+        self.send_header('Content-Length', str(length))
+        self.send_header('Last-Modified',
+                self.date_time_string(int(os.path.getmtime(path))))
+        if ranges and not parts:
+            self.send_header('Content-Range',
+                    'bytes %d-%d/%d' % (ranges[0][0], ranges[0][1], size))
+        self.end_headers()
+        if not body:
+            return
+        if random.random() < self.server.stall:
+            # headers, then nothing for a while
+            self.wfile.flush()
+            time.sleep(self.server.stall_time)
+
+        with open(path, 'rb') as fh:
+            try:
+                if parts:
+                    for part, (start, end) in zip(parts, ranges):
+                        self.wfile.write(part)
+                        self._copy(fh, start, end)
+                    self.wfile.write(trailer)
+                elif ranges:
+                    self._copy(fh, ranges[0][0], ranges[0][1])
+                else:
+                    self._copy(fh, 0, size - 1)
+            except (IOError, OSError):
+                # client hung up once it had enough
+                self.close_connection = True
+
+    def do_GET(self):
+        self._send(True)
+
+    def do_HEAD(self):
+        self._send(False)
+
+    def log_message(self, format, *args):
+        if self.server.verbose:
+            BaseHTTPRequestHandler.log_message(self, format, *args)
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage='%prog [options] <directory>')
+    parser.add_option('-p', '--port', type='int', default=8000,
+            help='port to listen on [8000]')
+    parser.add_option('-d', '--delay', type='float', default=0,
+            help='seconds of latency to add to each request [0]')
+    parser.add_option('-f', '--fail', type='float', default=0,
+            help='fraction of requests to answer with an error [0]')
+    parser.add_option('--fail-status', type='int', default=503,
+            help='HTTP status of failed requests [503]')
+    parser.add_option('--stall', type='float', default=0,
+            help='fraction of responses to stall before the body [0]')
+    parser.add_option('--stall-time', type='float', default=30,
+            help='seconds a stalled response waits [30]')
+    parser.add_option('-s', '--single-range', action='store_true',
+            help='answer multi-range requests with the whole file')
+    parser.add_option('-v', '--verbose', action='store_true',
+            help='log requests')
+    opts, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('missing directory')
+
+    server = ThreadedHTTPServer(('127.0.0.1', opts.port), RangeHandler)
+    server.root = os.path.abspath(args[0])
+    server.delay = opts.delay
+    server.single_range = opts.single_range
+    server.fail = opts.fail
+    server.fail_status = opts.fail_status
+    server.stall = opts.stall
+    server.stall_time = opts.stall_time
+    server.verbose = opts.verbose
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,109 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2012 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Open a remote TIFF the way the TIFF-based vendor drivers do: parse it
+   with the tifflike parser, as detection does, then walk every directory
+   with libtiff through the TIFF handle cache, as the opener does.  Reports
+   the directory count and the time taken.
+
+   test/open-requests.py runs this against test/range-server.py and counts
+   the requests it makes; libtiff's directory reads should be served from
+   the ranges the tifflike parser already fetched. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <tiffio.h>
+
+#include "openremoteslide-private.h"
+#include "openremoteslide-decode-tiff.h"
+#include "openremoteslide-decode-tifflike.h"
+#include "openremoteslide-url.h"
+
+int main(int argc, char **argv) {
+  GError *err = NULL;
+
+  if (argc != 2) {
+    printf("Usage: %s <url>\n", argv[0]);
+    return 2;
+  }
+
+  urlio_finitial();
+  gint64 start = g_get_monotonic_time();
+
+  // detection
+  struct _openremoteslide_tifflike *tl =
+    _openremoteslide_tifflike_create(argv[1], &err);
+  if (tl == NULL) {
+    printf("tifflike: %s\n", err->message);
+    g_clear_error(&err);
+    return 1;
+  }
+  int64_t tl_dirs = _openremoteslide_tifflike_get_directory_count(tl);
+  gint64 detected = g_get_monotonic_time();
+
+  // open
+  struct _openremoteslide_tiffcache *tc =
+    _openremoteslide_tiffcache_create(argv[1]);
+  TIFF *tiff = _openremoteslide_tiffcache_get(tc, &err);
+  if (tiff == NULL) {
+    printf("libtiff: %s\n", err->message);
+    g_clear_error(&err);
+    _openremoteslide_tiffcache_destroy(tc);
+    _openremoteslide_tifflike_destroy(tl);
+    return 1;
+  }
+  int64_t dirs = 0;
+  bool ok = true;
+  do {
+    uint32_t width;
+    toff_t *offsets;
+    if (!TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width) ||
+        (TIFFIsTiled(tiff) &&
+         !TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets))) {
+      printf("libtiff: can't read directory %"PRId64"\n", dirs);
+      ok = false;
+    }
+    dirs++;
+  } while (TIFFReadDirectory(tiff));
+  if (!_openremoteslide_tiff_set_dir(tiff, 0, &err)) {
+    printf("libtiff: %s\n", err->message);
+    g_clear_error(&err);
+    ok = false;
+  }
+  gint64 opened = g_get_monotonic_time();
+
+  if (dirs != tl_dirs) {
+    printf("tifflike found %"PRId64" directories, libtiff %"PRId64"\n",
+           tl_dirs, dirs);
+    ok = false;
+  }
+  printf("%"PRId64" directories, detect %.1f ms, open %.1f ms\n", dirs,
+         (detected - start) / 1000.0, (opened - detected) / 1000.0);
+
+  _openremoteslide_tiffcache_put(tc, tiff);
+  _openremoteslide_tiffcache_destroy(tc);
+  _openremoteslide_tifflike_destroy(tl);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2012 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Read <slides> remote copies of a URL end to end through urlio, using the
+   specified number of threads, and report the throughput.  Each copy gets
+   its own query string, so every read is a cache miss on its own handle.
+
+   Pair with test/range-server.py to measure miss concurrency, e.g.
+     test/range-server.py --delay 0.05 /path/to/slides &
+     for t in 1 2 4 8; do
+       test/urlio-parallel http://127.0.0.1:8000/CMU-1.svs 16 $t
+     done
+
+   For HTTP/2 multiplexing, serve the directory from an h2c server instead
+   and select prior-knowledge mode, e.g.
+     nghttpd --no-tls -d /path/to/slides 8443 &
+     OPENREMOTESLIDE_URLIO_HTTP2=prior-knowledge \
+       test/urlio-parallel http://127.0.0.1:8443/CMU-1.svs 16 8
+
+   An optional deadline in milliseconds bounds each copy's reads.  Against
+   a faulty server, retries should ride out the errors, hedging should
+   hide the stalls, and the deadline should cut off what's left, e.g.
+     test/range-server.py --fail 0.05 --stall 0.02 /path/to/slides &
+     OPENREMOTESLIDE_URLIO_HEDGE=1 \
+       test/urlio-parallel http://127.0.0.1:8000/CMU-1.svs 16 4 20000
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include "openremoteslide-url.h"
+
+#define READ_SIZE (64 * 1024)
+
+struct state {
+  GAsyncQueue *jobs;
+  GMutex lock;
+  int64_t bytes;
+  int64_t deadline_ms;
+  int failures;
+  bool failed;
+};
+
+static char sentinel;
+
+static void *thread_func(void *data) {
+  struct state *state = data;
+  char *buf = g_malloc(READ_SIZE);
+
+  while (1) {
+    char *url = g_async_queue_pop(state->jobs);
+    if (url == &sentinel) {
+      break;
+    }
+
+    urlio_set_deadline(state->deadline_ms);
+    URLIO_FILE *file = urlio_fopen(url, "r");
+    if (file == NULL) {
+      g_mutex_lock(&state->lock);
+      state->failed = true;
+      g_mutex_unlock(&state->lock);
+      continue;
+    }
+
+    size_t count;
+    int64_t total = 0;
+    while ((count = urlio_fread(buf, 1, READ_SIZE, file)) > 0) {
+      total += count;
+    }
+    bool read_failed = urlio_ferror(file);
+    urlio_fclose(file);
+
+    // the URL is never opened again; drop its handle and blocks
+    urlio_frelease(url);
+
+    g_mutex_lock(&state->lock);
+    state->bytes += total;
+    if (read_failed) {
+      state->failures++;
+    }
+    g_mutex_unlock(&state->lock);
+  }
+  g_free(buf);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  struct state state = { .bytes = 0, .failed = false };
+
+  if (argc != 4 && argc != 5) {
+    printf("Usage: %s <url> <slides> <threads> [deadline-ms]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 5) {
+    state.deadline_ms = atoll(argv[4]);
+  }
+
+  int slides = atoi(argv[2]);
+  int threads = atoi(argv[3]);
+  if (slides < 1 || threads < 1) {
+    printf("Invalid slide or thread count\n");
+    return 1;
+  }
+
+  urlio_finitial();
+  g_mutex_init(&state.lock);
+
+  // enqueue jobs
+  state.jobs = g_async_queue_new();
+  char **urls = g_new0(char *, slides + 1);
+  for (int i = 0; i < slides; i++) {
+    urls[i] = g_strdup_printf("%s%ccopy=%d", argv[1],
+                              strchr(argv[1], '?') ? '&' : '?', i);
+    g_async_queue_push(state.jobs, urls[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    g_async_queue_push(state.jobs, &sentinel);
+  }
+
+  // start threads
+  GTimer *timer = g_timer_new();
+  GThread **workers = g_new(GThread *, threads);
+  for (int i = 0; i < threads; i++) {
+    workers[i] = g_thread_new("urlio-parallel", thread_func, &state);
+  }
+
+  // wait for threads
+  for (int i = 0; i < threads; i++) {
+    g_thread_join(workers[i]);
+  }
+  double seconds = g_timer_elapsed(timer, NULL);
+
+  // print error or throughput
+  if (state.failed) {
+    printf("Couldn't open URL\n");
+  } else {
+    double mb = state.bytes / (1024.0 * 1024.0);
+    printf("%d slides, %g MB in %g seconds -> %g MB/sec\n", slides, mb,
+           seconds, mb / seconds);
+    if (state.failures) {
+      printf("%d slides stopped short by read errors\n", state.failures);
+    }
+
+    // what the fetcher settled on
+    struct urlio_host_stats stats[8];
+    int hosts = urlio_get_host_stats(stats, G_N_ELEMENTS(stats));
+    for (int i = 0; i < MIN(hosts, (int) G_N_ELEMENTS(stats)); i++) {
+      printf("%s: rtt %.1f ms, %.1f MB/sec per transfer, "
+             "%d slices per block, %d transfers in flight\n",
+             stats[i].host, stats[i].rtt_ms, stats[i].rate_mb_s,
+             stats[i].slices, stats[i].max_connections);
+    }
+  }
+
+  // clean up
+  g_timer_destroy(timer);
+  g_free(workers);
+  g_strfreev(urls);
+  g_async_queue_unref(state.jobs);
+  g_mutex_clear(&state.lock);
+  return state.failed ? 1 : 0;
+}
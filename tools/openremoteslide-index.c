@@ -0,0 +1,101 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "openremoteslide.h"
+#include "openremoteslide-tools-common.h"
+#include "openremoteslide-url.h"
+
+static gboolean process(const char *url) {
+  // opening the slide parses it and saves the index
+  openremoteslide_t *osr = openremoteslide_open(url);
+  if (osr == NULL) {
+    fprintf(stderr, "%s: %s: Not a file that OpenSlide can recognize\n",
+	    g_get_prgname(), url);
+    fflush(stderr);
+    return FALSE;
+  }
+
+  const char *err = openremoteslide_get_error(osr);
+  if (err) {
+    fprintf(stderr, "%s: %s: %s\n", g_get_prgname(), url, err);
+    fflush(stderr);
+    openremoteslide_close(osr);
+    return FALSE;
+  }
+
+  printf("%s\n", url);
+  openremoteslide_close(osr);
+  return TRUE;
+}
+
+// one URL per line; blank lines are skipped
+static gboolean process_list(FILE *f) {
+  gboolean ok = TRUE;
+  char line[4096];
+
+  while (fgets(line, sizeof(line), f)) {
+    g_strstrip(line);
+    if (line[0] && !process(line)) {
+      ok = FALSE;
+    }
+  }
+  return ok;
+}
+
+
+static const struct openremoteslide_tools_usage_info usage_info = {
+  "URL...",
+  "Build OpenSlide indexes for remote slides (\"-\" reads URLs from stdin).",
+};
+
+int main (int argc, char **argv) {
+  _openremoteslide_tools_parse_commandline(&usage_info, &argc, &argv);
+  if (argc < 2) {
+    _openremoteslide_tools_usage(&usage_info);
+  }
+
+  const char *dir = g_getenv(URLIO_DISK_CACHE_DIR_ENV_VAR);
+  if (!dir || !dir[0]) {
+    fprintf(stderr, "%s: %s is not set; indexes won't be kept after "
+            "this program exits\n", g_get_prgname(),
+            URLIO_DISK_CACHE_DIR_ENV_VAR);
+    fflush(stderr);
+  }
+  openremoteslide_set_slide_index(true);
+
+  int ret = 0;
+  for (int i = 1; i < argc; i++) {
+    gboolean ok;
+    if (!strcmp(argv[i], "-")) {
+      ok = process_list(stdin);
+    } else {
+      ok = process(argv[i]);
+    }
+    if (!ok) {
+      ret = 1;
+    }
+  }
+
+  return ret;
+}